@@ -1,6 +1,7 @@
 #pragma once
 
 #include "math.hpp"
+#include "thread_pool.h"
 #include <string>
 
 struct Volume {
@@ -10,7 +11,7 @@ struct Volume {
     uint32_t depth;
     float3 size;
 
-    uint16_t sample_at(float3 world_pos) {
+    uint16_t sample_at(float3 world_pos) const {
         if (abs(world_pos.x) < size.x / 2) {
             if (abs(world_pos.y) < size.z / 2) {
                 if (abs(world_pos.z) < size.y / 2) {
@@ -28,8 +29,13 @@ struct Volume {
         return 0;
     }
 
-    float3 gradient_at(float3 world_pos) {
-        float3 voxel_size = float3(size.x / width, size.y / height, size.z / depth);
+    // Edge lengths of one voxel in world units
+    float3 voxel_size() const {
+        return float3(size.x / width, size.y / height, size.z / depth);
+    }
+
+    float3 gradient_at(float3 world_pos) const {
+        float3 voxel_size = this->voxel_size();
 
         uint16_t sample = sample_at(world_pos);
         uint16_t gradient_x = sample_at(float3(world_pos.x + voxel_size.x, world_pos.y, world_pos.z)) - sample;
@@ -41,7 +47,7 @@ struct Volume {
 
     // I think we can pick any perpendicular angle to the normal?
     // There's no textures so we don't need to consider that?
-    float3 tangent_at(float3 world_pos) {
+    float3 tangent_at(float3 world_pos) const {
         float3 normal = gradient_at(world_pos);
 
         // TODO: handle case when -normal.x = normal.y
@@ -49,7 +55,22 @@ struct Volume {
     }
 };
 
+// Raw Hounsfield loading stores HU + DICOM_HU_OFFSET, clamped to the uint16_t
+// range, so air lands near zero and every slice shares one scale
+#define DICOM_HU_OFFSET 1024
+
+struct MappedVolume;
+
 class Dicom {
+private:
+    // Set when volume.data points into a mapped volume cache instead of
+    // being allocated by the loader
+    MappedVolume* mapped;
+
+    void ReleaseVolume();
+    // Replaces the volume with a mapped cache, taking ownership of it
+    void UseMappedVolume(MappedVolume* cache);
+
 public:
     Volume volume;
     uint16_t max_value;
@@ -57,5 +78,13 @@ public:
     Dicom();
     ~Dicom();
 
-    int LoadDicomStack(const std::string& folder, float3* size, bool should_mask, uint8_t mask_value);
+    // Loads one series of the .dcm files in folder, the largest if series is
+    // empty. Headers are indexed in the folder so later loads skip them.
+    // Slices are parsed and converted on the pool. With raw_hounsfield the
+    // stored values are rescaled to Hounsfield units instead of windowing
+    // every slice to its own min/max. The result is cached in the folder as
+    // a .mirvol file, or in a shared memory segment if the folder is read
+    // only, and every load maps it read only so processes rendering the same
+    // study share one copy.
+    int LoadDicomStack(const std::string& folder, const std::string& series, float3* size, bool should_mask, uint8_t mask_value, bool raw_hounsfield, ThreadPool& pool);
 };
@@ -0,0 +1,39 @@
+#ifndef AO_VOLUME_H
+#define AO_VOLUME_H
+
+#include "math.hpp"
+#include "Dicom.hpp"
+#include "plf.h"
+#include "thread_pool.h"
+
+#include <vector>
+
+// Precomputed ambient occlusion over the volume's bounding box. Occlusion is
+// found by cone tracing a mip pyramid of the coarse occupancy implied by the
+// transfer function, so it has to be rebuilt whenever the PLF changes.
+class AOVolume {
+private:
+    uint32_t resolution;
+    float3 extent;
+    float cell_size;
+    float max_distance;
+
+    // Level 0 is resolution^3 cells, each level after halves every axis
+    std::vector<std::vector<float>> occupancy;
+    std::vector<half> ao;
+
+    float occupancy_at(float3 world_pos, uint32_t level);
+    float trace_cone(float3 origin, float3 direction, float tan_half_angle);
+
+public:
+    AOVolume();
+
+    // resolution must be a power of two. max_distance is the world space
+    // length of the occlusion cones.
+    void build(Volume& volume, PLF& plf, uint32_t resolution, float max_distance, ThreadPool& pool);
+
+    // Returns 1 for fully unoccluded, 0 for fully occluded
+    float ao_at(float3 world_pos) const;
+};
+
+#endif
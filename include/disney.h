@@ -24,19 +24,61 @@ public:
 
     static DisneyMaterial disney_lerp(DisneyMaterial l, DisneyMaterial r, float t);
 
+    // These prepare the material on every call, use PreparedMaterial when
+    // shading the same material more than once
     float GetPdf(float3 wi, float3 wo);
     float3 Evaluate(float3 wi, float3 wo);
     float3 Sample(float3 wi, float2 sample, float3& wo, float& pdf);
+};
+
+// BSDF lobes a material actually uses. Presets usually leave most of them at
+// zero, so PreparedMaterial picks a kernel that skips the inactive ones.
+enum MaterialLobe : uint32_t {
+    LOBE_CLEARCOAT = 1 << 0,
+    LOBE_SHEEN = 1 << 1,
+    LOBE_METALLIC = 1 << 2,
+    LOBE_ANISOTROPIC = 1 << 3,
+    LOBE_SUBSURFACE = 1 << 4,
+    LOBE_ALL = (1 << 5) - 1
+};
+
+class PreparedMaterial;
+
+// BSDF kernels behind PreparedMaterial, one copy per instruction set level in
+// the kernel table. Evaluate comes specialised for every lobe set.
+typedef float3 (*MaterialEvaluateFn)(const PreparedMaterial& m, float3 wi, float3 wo, float& pdf);
+typedef float3 (*MaterialSampleFn)(const PreparedMaterial& m, float3 wi, float2 sample, float3& wo, float& pdf);
+
+// A DisneyMaterial along with every quantity the BSDF derives from its
+// parameters, so they are computed once per material instead of once per call.
+// The kernels are picked from kernels() when the material is prepared, so
+// prepare materials after select_kernels.
+class PreparedMaterial {
+public:
+    DisneyMaterial params;
+
+    float ax;
+    float ay;
+    float cd_lum;
+    float3 c_spec0;
+    float3 c_sheen;
+    float cs_w; // probability of sampling the specular lobe over the diffuse one
+    float clearcoat_a;
+    float clearcoat_gtr1; // (a^2 - 1) / (PI * log(a^2)) for the clearcoat GTR1 lobe
+    uint32_t lobes; // MaterialLobe flags
+
+    PreparedMaterial();
+    explicit PreparedMaterial(const DisneyMaterial& material);
+
+    float GetPdf(float3 wi, float3 wo) const;
+    float3 Evaluate(float3 wi, float3 wo) const;
+    // Same as Evaluate and GetPdf for the same pair, sharing the common terms
+    float3 EvaluateWithPdf(float3 wi, float3 wo, float& pdf) const;
+    float3 Sample(float3 wi, float2 sample, float3& wo, float& pdf) const;
 
 private:
-    float SchlickFresnelReflectance(float u);
-    float GTR1(float ndoth, float a);
-    float GTR2(float ndoth, float a);
-    float GTR2_Aniso(float ndoth, float hdotx, float hdoty, float ax, float ay);
-    float SmithGGX_G(float ndotv, float a);
-    float SmithGGX_G_Aniso(float ndotv, float vdotx, float vdoty, float ax, float ay);
-    float3 Sample_MapToHemisphere(float2 sample, float3 n, float e);
-    float3 GetOrthoVector(float3 n);
+    MaterialEvaluateFn evaluate_kernel;
+    MaterialSampleFn sample_kernel;
 };
 
 #endif
@@ -0,0 +1,54 @@
+#ifndef DISNEY_BATCH_H
+#define DISNEY_BATCH_H
+
+#include "math.hpp"
+#include "disney.h"
+
+// Number of (material, wi, wo) tuples shaded per call. The layout does not
+// depend on the instruction set: AVX-512 builds process a batch as one vector,
+// AVX2 as two and everything else falls back to SSE or scalar code.
+#define DISNEY_BATCH_SIZE 16
+
+struct Float3Batch {
+    alignas(64) float x[DISNEY_BATCH_SIZE];
+    alignas(64) float y[DISNEY_BATCH_SIZE];
+    alignas(64) float z[DISNEY_BATCH_SIZE];
+
+    inline void set(int lane, float3 v) {
+        x[lane] = v.x;
+        y[lane] = v.y;
+        z[lane] = v.z;
+    }
+    inline float3 get(int lane) const {
+        return float3(x[lane], y[lane], z[lane]);
+    }
+};
+
+// Structure-of-arrays form of DisneyMaterial. Nothing in the renderer shades
+// through it yet, the path tracer shades one hit at a time with
+// PreparedMaterial; tests/disney_batch_test.cpp keeps it equal to the scalar
+// BSDF for a future wavefront integrator. Every lane has to hold a valid
+// material, fill unused lanes with a default one and ignore their output.
+// All directions are in tangent space, same as DisneyMaterial.
+class DisneyMaterialBatch {
+public:
+    Float3Batch BaseColor;
+    alignas(64) float Metallic[DISNEY_BATCH_SIZE];
+    alignas(64) float Specular[DISNEY_BATCH_SIZE];
+    alignas(64) float Anisotropy[DISNEY_BATCH_SIZE];
+    alignas(64) float Roughness[DISNEY_BATCH_SIZE];
+    alignas(64) float SpecularTint[DISNEY_BATCH_SIZE];
+    alignas(64) float SheenTint[DISNEY_BATCH_SIZE];
+    alignas(64) float Sheen[DISNEY_BATCH_SIZE];
+    alignas(64) float ClearcoatGloss[DISNEY_BATCH_SIZE];
+    alignas(64) float Clearcoat[DISNEY_BATCH_SIZE];
+    alignas(64) float Subsurface[DISNEY_BATCH_SIZE];
+
+    void set(int lane, const DisneyMaterial& material);
+
+    void GetPdf(const Float3Batch& wi, const Float3Batch& wo, float* pdf) const;
+    void Evaluate(const Float3Batch& wi, const Float3Batch& wo, Float3Batch& result) const;
+    void Sample(const Float3Batch& wi, const float* sample_x, const float* sample_y, Float3Batch& wo, float* pdf, Float3Batch& result) const;
+};
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef FILE_READER_H
+#define FILE_READER_H
+
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Called on a pool worker with the whole contents of files[index]. The
+// buffer is freed as soon as it returns.
+typedef std::function<void(size_t index, const uint8_t* data, size_t size)> FileConsumer;
+
+// Reads every file in full and hands it to consume on the pool, in completion
+// order. With MIR_HAVE_LIBURING and a kernel that supports it, opens and reads
+// go through io_uring so up to max_in_flight files are being read or waiting
+// for a worker at once, which hides per-file latency on network storage.
+// Otherwise, and for the files left over if the ring fails partway, every
+// worker reads its own files with blocking calls. Returns false if any file
+// could not be read, consume is not called for those.
+bool ReadFiles(const std::vector<std::string>& files, ThreadPool& pool, size_t max_in_flight, const FileConsumer& consume);
+
+#endif
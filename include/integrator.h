@@ -0,0 +1,53 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include "math.hpp"
+#include "Dicom.hpp"
+#include "plf.h"
+#include "rng.h"
+#include "ray.h"
+#include "radiance_cache.h"
+#include "ao_volume.h"
+#include "light.h"
+
+#define MAX_BOUNCES 1 // maximum path depth
+#define RR_MIN_DEPTH 3 // bounces before russian roulette may terminate a path
+#define RR_MAX_SURVIVAL 0.95f // upper bound on the survival probability so paths always end
+#define LIGHT_RADIUS 0.1f // radius of the spherical scene light
+#define LIGHT_INTENSITY 1.f // radiant intensity of the scene light
+#define LIGHT_SPLIT 1 // shadow rays per primary hit
+#define BSDF_SPLIT 1 // independent BSDF continuations per primary hit
+#define RAY_OFFSET_VOXELS 3.f // how far rays leaving a surface start from it, in voxels
+#define MAX_DENSITY 1.f // affects the chance of check for a hit being true
+#define DENSITY_MULTIPLIER 100.f // increases probability of checking for a hit
+#define PREVIEW_AMBIENT 0.5f // intensity of the uniform ambient light in preview mode
+
+// Everything the integrator reads while rendering. It is built once before the
+// render loop and passed down by const reference, so the hot path never copies
+// or allocates scene state. The radiance cache is the one part written to.
+struct SceneContext {
+    const Volume& volume;
+    const PLF& plf;
+    SphereLight light;
+    RadianceCache* cache;
+    const AOVolume* ao;
+};
+
+// Just one spherical light for now
+SphereLight SceneLight();
+
+// Whether the light is reachable from the surface point p along wo, with
+// light_distance measured from p
+bool LightVisible(float3 p, float3 wo, float light_distance, Rng& rng, const SceneContext& scene);
+
+typedef float3 (*TraceFunction)(Ray ray, Rng& rng, const SceneContext& scene);
+
+// Picks the path tracer variant for settings that are fixed for a whole
+// render. None of the variants, nor the preview, allocates on the heap.
+TraceFunction select_integrator(int max_bounces, bool emissive, bool use_cache);
+
+// Approximate shading for quick previews: direct lighting from the BSDF plus an
+// ambient term attenuated by the precomputed AO volume. Only the first hit is shaded.
+float3 trace_ray_preview(Ray ray, Rng& rng, const SceneContext& scene);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "math.hpp"
+#include "Dicom.hpp"
+#include "plf.h"
+#include "disney_batch.h"
+
+#include <array>
+#include <string>
+#include <utility>
+
+// Instruction set levels the hot kernels are compiled for. BASELINE is
+// whatever the rest of the binary targets, the others are only available on
+// x86 with GCC, where the build compiles kernels.inl once more per
+// level with that level's -m flags.
+enum class IsaLevel {
+    BASELINE,
+    SSE42,
+    AVX2,
+    AVX512
+};
+
+// One copy of the hot kernels compiled for a single instruction set level
+struct Kernels {
+    IsaLevel isa;
+
+    // Steps along the ray until it hits a sample with non-zero density or
+    // leaves the [-2, 2] bounds. distance is where the march stopped, hit
+    // or not.
+    bool (*march)(const Volume& volume, const PLF& plf, float3 origin, float3 direction, float& distance, uint16_t& sample);
+
+    // ACES tonemap and 2.2 gamma, in place is allowed
+    void (*tonemap)(const float3* hdr, float3* ldr, size_t count);
+
+    // Applies the DICOM modality rescale to stored pixel values and writes
+    // HU + DICOM_HU_OFFSET. Each value is the bits_stored bits ending at
+    // high_bit, two's complement when is_signed, with high_bit in [0, 15] and
+    // bits_stored in [1, high_bit + 1]. Returns the largest value written.
+    uint16_t (*rescale_hounsfield)(const uint16_t* stored, uint32_t bits_stored, uint32_t high_bit, bool is_signed, float slope, float intercept, uint16_t* out, size_t count);
+
+    // PreparedMaterial::EvaluateWithPdf indexed by MaterialLobe flags, and
+    // PreparedMaterial::Sample. This is the BSDF the integrator shades with.
+    const MaterialEvaluateFn* material_evaluate;
+    MaterialSampleFn material_sample;
+
+    // DisneyMaterialBatch
+    void (*bsdf_get_pdf)(const DisneyMaterialBatch& b, const Float3Batch& wi, const Float3Batch& wo, float* pdf);
+    void (*bsdf_evaluate)(const DisneyMaterialBatch& b, const Float3Batch& wi, const Float3Batch& wo, Float3Batch& result);
+    void (*bsdf_sample)(const DisneyMaterialBatch& b, const Float3Batch& wi, const float* sample_x, const float* sample_y, Float3Batch& wo, float* pdf, Float3Batch& result);
+};
+
+// Highest level both compiled in and supported by this CPU
+IsaLevel detect_isa();
+
+const char* isa_name(IsaLevel isa);
+// Accepts the names returned by isa_name
+bool parse_isa(const std::string& name, IsaLevel& isa);
+
+// Switches every later kernels() call to the given level, falling back to
+// the highest supported level below it. Returns the level actually selected.
+IsaLevel select_kernels(IsaLevel isa);
+
+// Kernels for the selected level, detect_isa() until select_kernels is called
+const Kernels& kernels();
+
+#endif
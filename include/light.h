@@ -0,0 +1,33 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include "math.hpp"
+#include "ray.h"
+
+// Spherical area light. Unlike a point light it can be hit by BSDF sampled
+// rays, which lets the integrator weight light and BSDF sampling with MIS.
+class SphereLight {
+public:
+    float3 position;
+    float radius;
+    float3 emission;
+
+    // intensity is the radiant intensity seen from far away, the emitted
+    // radiance is derived from it so changing the radius keeps brightness
+    SphereLight(float3 position, float radius, float3 intensity);
+
+    // Samples a direction from p uniformly within the cone subtended by the
+    // light. Returns the solid angle pdf, or 0 if p is inside the light.
+    float Sample(float3 p, float2 sample, float3& wo, float& distance) const;
+
+    // Solid angle pdf of Sample returning wo from p
+    float GetPdf(float3 p, float3 wo) const;
+
+    // Distance along the ray to the light surface, or -1 if it is missed
+    float Intersect(Ray ray) const;
+
+private:
+    float GetConeCos(float3 p) const;
+};
+
+#endif
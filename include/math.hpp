@@ -12,6 +12,15 @@
 #include <math.h>
 #include <functional>
 #include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__AVX512F__) || defined(__F16C__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 #ifdef far
 #undef far
@@ -2951,6 +2960,909 @@ inline quaternion slerp(const quaternion& v0, quaternion v1, const float t){
     return v0 * s0 + v1 * s1;
 }
 
+#pragma region fast math
+// Approximate transcendentals, polynomial fits from Cephes. approx_* are
+// always the approximation and are meant for positive, finite inputs. fast_*
+// map to approx_* when MIR_FAST_MATH is defined and to libm otherwise. Their
+// callers are the lobe sampling in MaterialSample (fast_pow, fast_sincos), the
+// tonemap gamma (fast_pow) and Camera::get_ray (fast_normalize). The wide
+// vectors region has floatx versions, used by the batched BSDF for sampling
+// and its clearcoat GTR1 (fast_log2). Scalar BSDF evaluation, GTR1 and GTR2
+// included, uses no transcendentals.
+//
+// Max error against double precision libm over the ranges given, checked by
+// tests/fast_math_test.cpp:
+//   approx_exp2    [-126, 127]                 1.1e-7 relative
+//   approx_log2    [1e-30, 1e30]               8.0e-8 absolute below 1, relative above
+//   approx_pow     a in (0, 1], b in [0, 64]   9.0e-6 relative, for normal results
+//   approx_sincos  [-8192, 8192]               9.3e-8 absolute
+//   approx_rsqrt   [1e-30, 1e30]               2.7e-7 relative with SSE, 4.8e-6 without
+
+inline float as_float(uint32_t u) {
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+inline uint32_t as_uint(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+inline float approx_exp2(float x) {
+    x = clamp(x, -126.f, 127.f);
+
+    // 2^x = 2^i * 2^f with f in [-0.5, 0.5]
+    float i = floorf(x + 0.5f);
+    float f = x - i;
+
+    float p = 1.535336188319500e-4f;
+    p = p * f + 1.339887440266574e-3f;
+    p = p * f + 9.618437357674640e-3f;
+    p = p * f + 5.550332471162809e-2f;
+    p = p * f + 2.402264791363012e-1f;
+    p = p * f + 6.931472028550421e-1f;
+    p = p * f + 1.f;
+
+    return p * as_float((uint32_t)((int32_t)i + 127) << 23);
+}
+
+inline float approx_log2(float x) {
+    // x = m * 2^e with m in [sqrt(0.5), sqrt(2))
+    uint32_t u = as_uint(x);
+    int32_t e = (int32_t)((u >> 23) & 0xFF) - 127;
+    float m = as_float((u & 0x007FFFFF) | 0x3F800000);
+    if (m > 1.41421356f) {
+        m *= 0.5f;
+        e++;
+    }
+
+    float z = m - 1.f;
+    float z2 = z * z;
+
+    float p = 7.0376836292e-2f;
+    p = p * z - 1.1514610310e-1f;
+    p = p * z + 1.1676998740e-1f;
+    p = p * z - 1.2420140846e-1f;
+    p = p * z + 1.4249322787e-1f;
+    p = p * z - 1.6668057665e-1f;
+    p = p * z + 2.0000714765e-1f;
+    p = p * z - 2.4999993993e-1f;
+    p = p * z + 3.3333331174e-1f;
+
+    float ln = z + z2 * (p * z - 0.5f);
+    return ln * 1.44269504089f + (float)e;
+}
+
+// Only defined for a >= 0, returns 0 for a == 0
+inline float approx_pow(float a, float b) {
+    if (a <= 0.f) return 0.f;
+    return approx_exp2(b * approx_log2(a));
+}
+
+inline void approx_sincos(float x, float& s, float& c) {
+    // Reduce to [-PI/4, PI/4] around the nearest multiple of PI/2, with PI/2
+    // split in three so the reduction stays exact for large x
+    float q = floorf(x * 0.636619772f + 0.5f);
+    float r = x - q * 1.5703125f;
+    r -= q * 4.837512969970703125e-4f;
+    r -= q * 7.54978995489188216e-8f;
+    float r2 = r * r;
+
+    float sr = -1.9515295891e-4f;
+    sr = sr * r2 + 8.3321608736e-3f;
+    sr = sr * r2 - 1.6666654611e-1f;
+    sr = r + r * r2 * sr;
+
+    float cr = 2.443315711809948e-5f;
+    cr = cr * r2 - 1.388731625493765e-3f;
+    cr = cr * r2 + 4.166664568298827e-2f;
+    cr = 1.f - 0.5f * r2 + r2 * r2 * cr;
+
+    switch ((int32_t)q & 3) {
+    case 0: s = sr; c = cr; break;
+    case 1: s = cr; c = -sr; break;
+    case 2: s = -sr; c = -cr; break;
+    default: s = -cr; c = sr; break;
+    }
+}
+
+inline float approx_rsqrt(float x) {
+#if defined(__SSE__) || defined(_M_X64)
+    float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+    return y * (1.5f - 0.5f * x * y * y);
+#else
+    float y = as_float(0x5F375A86 - (as_uint(x) >> 1));
+    y = y * (1.5f - 0.5f * x * y * y);
+    return y * (1.5f - 0.5f * x * y * y);
+#endif
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+// Four lane versions of the above, same polynomials and error bounds
+inline __m128 approx_exp2(__m128 x) {
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-126.f)), _mm_set1_ps(127.f));
+
+    __m128i i = _mm_cvtps_epi32(x);
+    __m128 f = _mm_sub_ps(x, _mm_cvtepi32_ps(i));
+
+    __m128 p = _mm_set1_ps(1.535336188319500e-4f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.339887440266574e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.618437357674640e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.550332471162809e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.402264791363012e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.931472028550421e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.f));
+
+    __m128i e = _mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(e));
+}
+
+inline __m128 approx_log2(__m128 x) {
+    __m128i u = _mm_castps_si128(x);
+    __m128i e = _mm_sub_epi32(_mm_srli_epi32(u, 23), _mm_set1_epi32(127));
+    __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(u, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000)));
+
+    __m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+    m = _mm_mul_ps(m, _mm_or_ps(_mm_and_ps(big, _mm_set1_ps(0.5f)), _mm_andnot_ps(big, _mm_set1_ps(1.f))));
+    __m128 ef = _mm_add_ps(_mm_cvtepi32_ps(e), _mm_and_ps(big, _mm_set1_ps(1.f)));
+
+    __m128 z = _mm_sub_ps(m, _mm_set1_ps(1.f));
+    __m128 z2 = _mm_mul_ps(z, z);
+
+    __m128 p = _mm_set1_ps(7.0376836292e-2f);
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(-1.1514610310e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.1676998740e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(-1.2420140846e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.4249322787e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(-1.6668057665e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(2.0000714765e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(-2.4999993993e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(3.3333331174e-1f));
+
+    __m128 ln = _mm_add_ps(z, _mm_mul_ps(z2, _mm_sub_ps(_mm_mul_ps(p, z), _mm_set1_ps(0.5f))));
+    return _mm_add_ps(_mm_mul_ps(ln, _mm_set1_ps(1.44269504089f)), ef);
+}
+
+inline __m128 approx_pow(__m128 a, __m128 b) {
+    __m128 r = approx_exp2(_mm_mul_ps(b, approx_log2(a)));
+    return _mm_and_ps(r, _mm_cmpgt_ps(a, _mm_setzero_ps()));
+}
+
+inline void approx_sincos(__m128 x, __m128& s, __m128& c) {
+    __m128i qi = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.636619772f)));
+    __m128 q = _mm_cvtepi32_ps(qi);
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(q, _mm_set1_ps(1.5703125f)));
+    r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(4.837512969970703125e-4f)));
+    r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(7.54978995489188216e-8f)));
+    __m128 r2 = _mm_mul_ps(r, r);
+
+    __m128 sr = _mm_set1_ps(-1.9515295891e-4f);
+    sr = _mm_add_ps(_mm_mul_ps(sr, r2), _mm_set1_ps(8.3321608736e-3f));
+    sr = _mm_add_ps(_mm_mul_ps(sr, r2), _mm_set1_ps(-1.6666654611e-1f));
+    sr = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), sr));
+
+    __m128 cr = _mm_set1_ps(2.443315711809948e-5f);
+    cr = _mm_add_ps(_mm_mul_ps(cr, r2), _mm_set1_ps(-1.388731625493765e-3f));
+    cr = _mm_add_ps(_mm_mul_ps(cr, r2), _mm_set1_ps(4.166664568298827e-2f));
+    cr = _mm_add_ps(_mm_sub_ps(_mm_set1_ps(1.f), _mm_mul_ps(_mm_set1_ps(0.5f), r2)), _mm_mul_ps(_mm_mul_ps(r2, r2), cr));
+
+    // Odd quadrants swap sin and cos, sin flips sign in quadrants 2 and 3
+    // and cos in quadrants 1 and 2
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(qi, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    __m128 s_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(qi, _mm_set1_epi32(2)), 30));
+    __m128 c_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(qi, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+
+    s = _mm_or_ps(_mm_and_ps(swap, cr), _mm_andnot_ps(swap, sr));
+    c = _mm_or_ps(_mm_and_ps(swap, sr), _mm_andnot_ps(swap, cr));
+    s = _mm_xor_ps(s, s_sign);
+    c = _mm_xor_ps(c, c_sign);
+}
+
+inline __m128 approx_rsqrt(__m128 x) {
+    __m128 y = _mm_rsqrt_ps(x);
+    __m128 yyx = _mm_mul_ps(_mm_mul_ps(y, y), x);
+    return _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_set1_ps(0.5f), yyx)));
+}
+#endif
+
+#ifdef MIR_FAST_MATH
+inline float fast_exp2(float x) { return approx_exp2(x); }
+inline float fast_log2(float x) { return approx_log2(x); }
+inline float fast_pow(float a, float b) { return approx_pow(a, b); }
+inline void fast_sincos(float x, float& s, float& c) { approx_sincos(x, s, c); }
+inline float fast_rsqrt(float x) { return approx_rsqrt(x); }
+#else
+inline float fast_exp2(float x) { return exp2f(x); }
+inline float fast_log2(float x) { return log2f(x); }
+inline float fast_pow(float a, float b) { return powf(a, b); }
+inline void fast_sincos(float x, float& s, float& c) { s = sinf(x); c = cosf(x); }
+inline float fast_rsqrt(float x) { return 1.f / sqrtf(x); }
+#endif
+
+inline float3 fast_normalize(const float3& v) {
+    return v * fast_rsqrt(dot(v, v));
+}
+#pragma endregion
+
+#pragma region half
+// IEEE 754 binary16 storage types for large tables, arithmetic happens after
+// converting to float. Uses the F16C instructions when the compiler targets
+// them and an exact round-to-nearest-even software conversion otherwise.
+inline uint16_t float_to_half(float f) {
+#if defined(__F16C__)
+    return (uint16_t)_cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+    uint32_t x = as_uint(f);
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t a = x & 0x7FFFFFFF;
+
+    // Inf and NaN, NaNs are quieted and keep the top of their payload
+    if (a >= 0x7F800000) return (uint16_t)(sign | 0x7C00 | (a > 0x7F800000 ? 0x200 | ((a >> 13) & 0x3FF) : 0));
+    // Rounds to inf
+    if (a >= 0x477FF000) return (uint16_t)(sign | 0x7C00);
+
+    // Subnormal half or zero
+    if (a < 0x38800000) {
+        if (a < 0x33000000) return (uint16_t)sign;
+
+        uint32_t shift = 126 - (a >> 23);
+        uint32_t m = (a & 0x007FFFFF) | 0x00800000;
+        uint32_t r = m >> shift;
+        uint32_t rem = m & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (r & 1))) r++;
+        return (uint16_t)(sign | r);
+    }
+
+    // Rebias the exponent, a carry out of the mantissa bumps it correctly
+    uint32_t r = (a - 0x38000000) >> 13;
+    uint32_t rem = a & 0x1FFF;
+    if (rem > 0x1000 || (rem == 0x1000 && (r & 1))) r++;
+    return (uint16_t)(sign | r);
+#endif
+}
+
+inline float half_to_float(uint16_t h) {
+#if defined(__F16C__)
+    return _cvtsh_ss(h);
+#else
+    // Shift exponent and mantissa into place and rebias, then patch up the
+    // two exponent values that don't map directly
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t o = (uint32_t)(h & 0x7FFF) << 13;
+    uint32_t e = o & 0x0F800000;
+    o += (127 - 15) << 23;
+
+    if (e == 0x0F800000) {
+        // Inf and NaN, NaNs are quieted
+        o += (128 - 16) << 23;
+        if (o & 0x007FFFFF) o |= 0x00400000;
+    } else if (e == 0) {
+        // Zero and subnormals, renormalize with a float subtraction
+        o = as_uint(as_float(o + (1 << 23)) - as_float(113 << 23));
+    }
+    return as_float(o | sign);
+#endif
+}
+
+struct half {
+    uint16_t bits;
+
+    inline half() : bits(0) {}
+    inline half(float f) : bits(float_to_half(f)) {}
+    inline operator float() const { return half_to_float(bits); }
+};
+
+struct half3 {
+    half x, y, z;
+
+    inline half3() {}
+    inline half3(const float3& v) : x(v.x), y(v.y), z(v.z) {}
+    inline operator float3() const { return float3(x, y, z); }
+};
+
+struct half4 {
+    half x, y, z, w;
+
+    inline half4() {}
+#if defined(__F16C__)
+    inline half4(const float4& v) {
+        __m128i h = _mm_cvtps_ph(_mm_loadu_ps(v.v), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storel_epi64((__m128i*)this, h);
+    }
+    inline operator float4() const {
+        float4 r;
+        _mm_storeu_ps(r.v, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)this)));
+        return r;
+    }
+#else
+    inline half4(const float4& v) : x(v.x), y(v.y), z(v.z), w(v.w) {}
+    inline operator float4() const { return float4(x, y, z, w); }
+#endif
+};
+#pragma endregion
+
+#pragma region float3a
+// 16 byte aligned float3 with a padding lane, for hot loops where the packed
+// 12 byte float3 does not vectorise. Operators use SSE or NEON when available
+// (define MATH_NO_SIMD to force the scalar path) and it converts to and from
+// float3 implicitly, so it can be introduced one loop at a time.
+#if !defined(MATH_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define MATH_SIMD_SSE
+#elif !defined(MATH_NO_SIMD) && defined(__ARM_NEON)
+#define MATH_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+struct alignas(16) float3a {
+    union {
+#if defined(MATH_SIMD_SSE)
+        __m128 m;
+#elif defined(MATH_SIMD_NEON)
+        float32x4_t m;
+#endif
+        float v[4];
+        struct { float x, y, z, w; };
+    };
+
+#if defined(MATH_SIMD_SSE)
+    inline float3a(__m128 m) : m(m) {};
+    inline float3a(float x, float y, float z) : m(_mm_set_ps(0.f, z, y, x)) {};
+    inline float3a(const float s) : m(_mm_set_ps(0.f, s, s, s)) {};
+#elif defined(MATH_SIMD_NEON)
+    inline float3a(float32x4_t m) : m(m) {};
+    inline float3a(float x, float y, float z) : v{ x, y, z, 0.f } {};
+    inline float3a(const float s) : v{ s, s, s, 0.f } {};
+#else
+    inline float3a(float x, float y, float z) : v{ x, y, z, 0.f } {};
+    inline float3a(const float s) : v{ s, s, s, 0.f } {};
+#endif
+    inline float3a(const float3& s) : float3a(s.x, s.y, s.z) {};
+    inline float3a() : float3a(0.f) {};
+
+    inline operator float3() const { return float3(x, y, z); }
+
+    inline float& operator[](int i) {
+        return v[i];
+    }
+    inline float operator[](int i) const {
+        return v[i];
+    }
+};
+
+#if defined(MATH_SIMD_SSE)
+inline float3a operator +(const float3a& a, const float3a& b) { return _mm_add_ps(a.m, b.m); }
+inline float3a operator -(const float3a& a, const float3a& b) { return _mm_sub_ps(a.m, b.m); }
+inline float3a operator *(const float3a& a, const float3a& b) { return _mm_mul_ps(a.m, b.m); }
+// Padding lane becomes 0 / 0, it is never read
+inline float3a operator /(const float3a& a, const float3a& b) { return _mm_div_ps(a.m, b.m); }
+inline float3a operator -(const float3a& a) { return _mm_sub_ps(_mm_setzero_ps(), a.m); }
+
+inline float3a min(const float3a& a, const float3a& b) { return _mm_min_ps(a.m, b.m); }
+inline float3a max(const float3a& a, const float3a& b) { return _mm_max_ps(a.m, b.m); }
+inline float3a abs(const float3a& a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.m); }
+
+inline float dot(const float3a& a, const float3a& b) {
+    __m128 p = _mm_mul_ps(a.m, b.m);
+    __m128 s = _mm_add_ps(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 0, 2, 1)));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 1, 0, 2))));
+}
+inline float3a cross(const float3a& a, const float3a& b) {
+    __m128 a_yzx = _mm_shuffle_ps(a.m, a.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_yzx = _mm_shuffle_ps(b.m, b.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a.m, b_yzx), _mm_mul_ps(a_yzx, b.m));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+// Largest absolute component
+inline float max_abs(const float3a& a) {
+    __m128 m = abs(a).m;
+    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 0, 2, 1)));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 1, 0, 2)));
+    return _mm_cvtss_f32(m);
+}
+#elif defined(MATH_SIMD_NEON)
+inline float3a operator +(const float3a& a, const float3a& b) { return vaddq_f32(a.m, b.m); }
+inline float3a operator -(const float3a& a, const float3a& b) { return vsubq_f32(a.m, b.m); }
+inline float3a operator *(const float3a& a, const float3a& b) { return vmulq_f32(a.m, b.m); }
+// Padding lane becomes 0 / 0, it is never read
+inline float3a operator /(const float3a& a, const float3a& b) {
+    float3a r;
+    rpt3(i) r.v[i] = a.v[i] / b.v[i];
+    return r;
+}
+inline float3a operator -(const float3a& a) { return vnegq_f32(a.m); }
+
+inline float3a min(const float3a& a, const float3a& b) { return vminq_f32(a.m, b.m); }
+inline float3a max(const float3a& a, const float3a& b) { return vmaxq_f32(a.m, b.m); }
+inline float3a abs(const float3a& a) { return vabsq_f32(a.m); }
+
+inline float dot(const float3a& a, const float3a& b) {
+    float32x4_t p = vmulq_f32(a.m, b.m);
+    return vgetq_lane_f32(p, 0) + vgetq_lane_f32(p, 1) + vgetq_lane_f32(p, 2);
+}
+inline float3a cross(const float3a& a, const float3a& b) {
+    return float3a(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+inline float max_abs(const float3a& a) {
+    float3a m = abs(a);
+    return fmaxf(fmaxf(m.x, m.y), m.z);
+}
+#else
+inline float3a operator +(const float3a& a, const float3a& b) { return float3a(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline float3a operator -(const float3a& a, const float3a& b) { return float3a(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline float3a operator *(const float3a& a, const float3a& b) { return float3a(a.x * b.x, a.y * b.y, a.z * b.z); }
+inline float3a operator /(const float3a& a, const float3a& b) { return float3a(a.x / b.x, a.y / b.y, a.z / b.z); }
+inline float3a operator -(const float3a& a) { return float3a(-a.x, -a.y, -a.z); }
+
+inline float3a min(const float3a& a, const float3a& b) { return float3a(fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z)); }
+inline float3a max(const float3a& a, const float3a& b) { return float3a(fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z)); }
+inline float3a abs(const float3a& a) { return float3a(fabsf(a.x), fabsf(a.y), fabsf(a.z)); }
+
+inline float dot(const float3a& a, const float3a& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+inline float3a cross(const float3a& a, const float3a& b) {
+    return float3a(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+inline float max_abs(const float3a& a) {
+    return fmaxf(fmaxf(fabsf(a.x), fabsf(a.y)), fabsf(a.z));
+}
+#endif
+
+inline float3a operator +(const float3a& a, const float s) { return a + float3a(s); }
+inline float3a operator -(const float3a& a, const float s) { return a - float3a(s); }
+inline float3a operator *(const float3a& a, const float s) { return a * float3a(s); }
+inline float3a operator /(const float3a& a, const float s) { return a * float3a(1.f / s); }
+inline float3a operator +(const float s, const float3a& a) { return float3a(s) + a; }
+inline float3a operator -(const float s, const float3a& a) { return float3a(s) - a; }
+inline float3a operator *(const float s, const float3a& a) { return float3a(s) * a; }
+
+inline float3a& operator +=(float3a& a, const float3a& b) { return a = a + b; }
+inline float3a& operator -=(float3a& a, const float3a& b) { return a = a - b; }
+inline float3a& operator *=(float3a& a, const float3a& b) { return a = a * b; }
+inline float3a& operator *=(float3a& a, const float s) { return a = a * s; }
+
+inline float length(const float3a& v) {
+    return sqrtf(dot(v, v));
+}
+inline float3a normalize(const float3a& v) {
+    return v * (1.f / length(v));
+}
+inline float3a lerp(const float3a& a, const float3a& b, const float t) {
+    return a + (b - a) * t;
+}
+inline float3a clamp(const float3a& a, const float3a& l, const float3a& h) {
+    return min(max(a, l), h);
+}
+#pragma endregion
+
+#pragma region wide vectors
+// N lane SoA vectors for packet and wavefront kernels. The generic templates
+// loop over plain arrays, 4, 8 and 16 lanes are specialised for SSE, AVX2 and
+// AVX-512 when the compiler targets them. MATH_MAX_LANES is the widest width
+// with a vector backend, so code written against floatx<MATH_MAX_LANES>
+// compiles to the widest available ISA. Operators are friends so scalars
+// convert implicitly, e.g. 1.f - x.
+#if defined(__AVX512F__)
+#define MATH_MAX_LANES 16
+#elif defined(__AVX2__)
+#define MATH_MAX_LANES 8
+#elif defined(__SSE2__) || defined(_M_X64)
+#define MATH_MAX_LANES 4
+#else
+#define MATH_MAX_LANES 1
+#endif
+
+// The specialisations below depend on the ISA the including file is compiled
+// for, and the kernels build one file per ISA. Naming the inline namespace
+// after the ISA gives every build of the templates its own mangled names, so
+// the linker never folds an AVX-512 floatx into code compiled for SSE.
+#if defined(__AVX512F__)
+#define MATH_WIDE_NAMESPACE wide_avx512
+#elif defined(__AVX2__)
+#define MATH_WIDE_NAMESPACE wide_avx2
+#elif defined(__SSE2__) || defined(_M_X64)
+#define MATH_WIDE_NAMESPACE wide_sse2
+#else
+#define MATH_WIDE_NAMESPACE wide_scalar
+#endif
+
+inline namespace MATH_WIDE_NAMESPACE {
+
+// Lerp and clamp in terms of the lane-wise operators, shared by all widths
+#define FLOATX_COMMON \
+    inline friend floatx lerp(floatx a, floatx b, floatx t) { return a + (b - a) * t; } \
+    inline friend floatx clamp(floatx x, floatx l, floatx h) { return min(max(x, l), h); }
+
+template <int N>
+struct maskx {
+    bool m[N];
+
+    inline friend maskx operator |(maskx a, maskx b) {
+        maskx r;
+        for (int i = 0; i < N; i++) r.m[i] = a.m[i] || b.m[i];
+        return r;
+    }
+    inline friend maskx operator &(maskx a, maskx b) {
+        maskx r;
+        for (int i = 0; i < N; i++) r.m[i] = a.m[i] && b.m[i];
+        return r;
+    }
+    inline friend bool any(maskx a) {
+        for (int i = 0; i < N; i++) if (a.m[i]) return true;
+        return false;
+    }
+    inline friend bool all(maskx a) {
+        for (int i = 0; i < N; i++) if (!a.m[i]) return false;
+        return true;
+    }
+};
+
+template <int N>
+struct floatx {
+    float v[N];
+
+    inline floatx() : floatx(0.f) {}
+    inline floatx(float s) { for (int i = 0; i < N; i++) v[i] = s; }
+    static inline floatx load(const float* p) {
+        floatx r;
+        for (int i = 0; i < N; i++) r.v[i] = p[i];
+        return r;
+    }
+    inline void store(float* p) const { for (int i = 0; i < N; i++) p[i] = v[i]; }
+
+    // Converts N 16 bit samples. Each is shifted left by left within 16 bits,
+    // dropping the bits above the value, then right by right, sign extending
+    // when is_signed. Both shifts have to be in [0, 15].
+    static inline floatx load_samples(const uint16_t* p, int left, int right, bool is_signed) {
+        floatx r;
+        for (int i = 0; i < N; i++) {
+            uint16_t s = (uint16_t)(p[i] << left);
+            r.v[i] = is_signed ? (float)((int16_t)s >> right) : (float)(s >> right);
+        }
+        return r;
+    }
+    // Truncates to 16 bit samples, every lane has to be in [0, 65535]
+    inline void store_samples(uint16_t* p) const { for (int i = 0; i < N; i++) p[i] = (uint16_t)v[i]; }
+
+    inline friend float hmax(floatx a) {
+        float r = a.v[0];
+        for (int i = 1; i < N; i++) r = a.v[i] > r ? a.v[i] : r;
+        return r;
+    }
+
+#define FLOATX_LANEWISE(ret, op, expr) \
+    inline friend ret op { \
+        ret r; \
+        for (int i = 0; i < N; i++) r.expr; \
+        return r; \
+    }
+    FLOATX_LANEWISE(floatx, operator +(floatx a, floatx b), v[i] = a.v[i] + b.v[i])
+    FLOATX_LANEWISE(floatx, operator -(floatx a, floatx b), v[i] = a.v[i] - b.v[i])
+    FLOATX_LANEWISE(floatx, operator *(floatx a, floatx b), v[i] = a.v[i] * b.v[i])
+    FLOATX_LANEWISE(floatx, operator /(floatx a, floatx b), v[i] = a.v[i] / b.v[i])
+    FLOATX_LANEWISE(floatx, operator -(floatx a), v[i] = -a.v[i])
+    FLOATX_LANEWISE(floatx, sqrt(floatx a), v[i] = sqrtf(a.v[i]))
+    FLOATX_LANEWISE(floatx, min(floatx a, floatx b), v[i] = fminf(a.v[i], b.v[i]))
+    FLOATX_LANEWISE(floatx, max(floatx a, floatx b), v[i] = fmaxf(a.v[i], b.v[i]))
+    FLOATX_LANEWISE(floatx, abs(floatx a), v[i] = fabsf(a.v[i]))
+    FLOATX_LANEWISE(maskx<N>, operator <(floatx a, floatx b), m[i] = a.v[i] < b.v[i])
+    FLOATX_LANEWISE(maskx<N>, operator >(floatx a, floatx b), m[i] = a.v[i] > b.v[i])
+    FLOATX_LANEWISE(maskx<N>, operator <=(floatx a, floatx b), m[i] = a.v[i] <= b.v[i])
+    FLOATX_LANEWISE(maskx<N>, operator >=(floatx a, floatx b), m[i] = a.v[i] >= b.v[i])
+    FLOATX_LANEWISE(floatx, select(maskx<N> m, floatx a, floatx b), v[i] = m.m[i] ? a.v[i] : b.v[i])
+#undef FLOATX_LANEWISE
+
+    FLOATX_COMMON
+};
+
+#if defined(__SSE2__) || defined(_M_X64)
+template <>
+struct maskx<4> {
+    __m128 m;
+
+    inline friend maskx operator |(maskx a, maskx b) { return { _mm_or_ps(a.m, b.m) }; }
+    inline friend maskx operator &(maskx a, maskx b) { return { _mm_and_ps(a.m, b.m) }; }
+    inline friend bool any(maskx a) { return _mm_movemask_ps(a.m) != 0; }
+    inline friend bool all(maskx a) { return _mm_movemask_ps(a.m) == 0xF; }
+};
+
+template <>
+struct floatx<4> {
+    __m128 v;
+
+    inline floatx() : v(_mm_setzero_ps()) {}
+    inline floatx(__m128 v) : v(v) {}
+    inline floatx(float s) : v(_mm_set1_ps(s)) {}
+    static inline floatx load(const float* p) { return _mm_loadu_ps(p); }
+    inline void store(float* p) const { _mm_storeu_ps(p, v); }
+
+    static inline floatx load_samples(const uint16_t* p, int left, int right, bool is_signed) {
+        __m128i s = _mm_sll_epi16(_mm_loadl_epi64((const __m128i*)p), _mm_cvtsi32_si128(left));
+        __m128i i;
+        if (is_signed) {
+            s = _mm_sra_epi16(s, _mm_cvtsi32_si128(right));
+            i = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+        } else {
+            s = _mm_srl_epi16(s, _mm_cvtsi32_si128(right));
+            i = _mm_unpacklo_epi16(s, _mm_setzero_si128());
+        }
+        return _mm_cvtepi32_ps(i);
+    }
+    inline void store_samples(uint16_t* p) const {
+        // SSE2 only packs with signed saturation, so pack around 32768
+        __m128i i = _mm_sub_epi32(_mm_cvttps_epi32(v), _mm_set1_epi32(32768));
+        __m128i s = _mm_xor_si128(_mm_packs_epi32(i, i), _mm_set1_epi16(-32768));
+        _mm_storel_epi64((__m128i*)p, s);
+    }
+
+    inline friend float hmax(floatx a) {
+        __m128 m = _mm_max_ps(a.v, _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(1, 0, 3, 2)));
+        m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtss_f32(m);
+    }
+
+    inline friend floatx operator +(floatx a, floatx b) { return _mm_add_ps(a.v, b.v); }
+    inline friend floatx operator -(floatx a, floatx b) { return _mm_sub_ps(a.v, b.v); }
+    inline friend floatx operator *(floatx a, floatx b) { return _mm_mul_ps(a.v, b.v); }
+    inline friend floatx operator /(floatx a, floatx b) { return _mm_div_ps(a.v, b.v); }
+    inline friend floatx operator -(floatx a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.f)); }
+    inline friend floatx sqrt(floatx a) { return _mm_sqrt_ps(a.v); }
+    inline friend floatx min(floatx a, floatx b) { return _mm_min_ps(a.v, b.v); }
+    inline friend floatx max(floatx a, floatx b) { return _mm_max_ps(a.v, b.v); }
+    inline friend floatx abs(floatx a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v); }
+    inline friend maskx<4> operator <(floatx a, floatx b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+    inline friend maskx<4> operator >(floatx a, floatx b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+    inline friend maskx<4> operator <=(floatx a, floatx b) { return { _mm_cmple_ps(a.v, b.v) }; }
+    inline friend maskx<4> operator >=(floatx a, floatx b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+    inline friend floatx select(maskx<4> m, floatx a, floatx b) { return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)); }
+
+    FLOATX_COMMON
+};
+#endif
+
+#if defined(__AVX2__)
+template <>
+struct maskx<8> {
+    __m256 m;
+
+    inline friend maskx operator |(maskx a, maskx b) { return { _mm256_or_ps(a.m, b.m) }; }
+    inline friend maskx operator &(maskx a, maskx b) { return { _mm256_and_ps(a.m, b.m) }; }
+    inline friend bool any(maskx a) { return _mm256_movemask_ps(a.m) != 0; }
+    inline friend bool all(maskx a) { return _mm256_movemask_ps(a.m) == 0xFF; }
+};
+
+template <>
+struct floatx<8> {
+    __m256 v;
+
+    inline floatx() : v(_mm256_setzero_ps()) {}
+    inline floatx(__m256 v) : v(v) {}
+    inline floatx(float s) : v(_mm256_set1_ps(s)) {}
+    static inline floatx load(const float* p) { return _mm256_loadu_ps(p); }
+    inline void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+    static inline floatx load_samples(const uint16_t* p, int left, int right, bool is_signed) {
+        __m128i s = _mm_sll_epi16(_mm_loadu_si128((const __m128i*)p), _mm_cvtsi32_si128(left));
+        __m256i i = is_signed ? _mm256_cvtepi16_epi32(_mm_sra_epi16(s, _mm_cvtsi32_si128(right)))
+                              : _mm256_cvtepu16_epi32(_mm_srl_epi16(s, _mm_cvtsi32_si128(right)));
+        return _mm256_cvtepi32_ps(i);
+    }
+    inline void store_samples(uint16_t* p) const {
+        __m256i i = _mm256_cvttps_epi32(v);
+        _mm_storeu_si128((__m128i*)p, _mm_packus_epi32(_mm256_castsi256_si128(i), _mm256_extracti128_si256(i, 1)));
+    }
+
+    inline friend float hmax(floatx a) {
+        return hmax(floatx<4>(_mm_max_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1))));
+    }
+
+    inline friend floatx operator +(floatx a, floatx b) { return _mm256_add_ps(a.v, b.v); }
+    inline friend floatx operator -(floatx a, floatx b) { return _mm256_sub_ps(a.v, b.v); }
+    inline friend floatx operator *(floatx a, floatx b) { return _mm256_mul_ps(a.v, b.v); }
+    inline friend floatx operator /(floatx a, floatx b) { return _mm256_div_ps(a.v, b.v); }
+    inline friend floatx operator -(floatx a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.f)); }
+    inline friend floatx sqrt(floatx a) { return _mm256_sqrt_ps(a.v); }
+    inline friend floatx min(floatx a, floatx b) { return _mm256_min_ps(a.v, b.v); }
+    inline friend floatx max(floatx a, floatx b) { return _mm256_max_ps(a.v, b.v); }
+    inline friend floatx abs(floatx a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v); }
+    inline friend maskx<8> operator <(floatx a, floatx b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+    inline friend maskx<8> operator >(floatx a, floatx b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+    inline friend maskx<8> operator <=(floatx a, floatx b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+    inline friend maskx<8> operator >=(floatx a, floatx b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+    inline friend floatx select(maskx<8> m, floatx a, floatx b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+
+    FLOATX_COMMON
+};
+#endif
+
+#if defined(__AVX512F__)
+template <>
+struct maskx<16> {
+    __mmask16 m;
+
+    inline friend maskx operator |(maskx a, maskx b) { return { (__mmask16)(a.m | b.m) }; }
+    inline friend maskx operator &(maskx a, maskx b) { return { (__mmask16)(a.m & b.m) }; }
+    inline friend bool any(maskx a) { return a.m != 0; }
+    inline friend bool all(maskx a) { return a.m == 0xFFFF; }
+};
+
+template <>
+struct floatx<16> {
+    __m512 v;
+
+    inline floatx() : v(_mm512_setzero_ps()) {}
+    inline floatx(__m512 v) : v(v) {}
+    inline floatx(float s) : v(_mm512_set1_ps(s)) {}
+    static inline floatx load(const float* p) { return _mm512_loadu_ps(p); }
+    inline void store(float* p) const { _mm512_storeu_ps(p, v); }
+
+    static inline floatx load_samples(const uint16_t* p, int left, int right, bool is_signed) {
+        __m256i s = _mm256_sll_epi16(_mm256_loadu_si256((const __m256i*)p), _mm_cvtsi32_si128(left));
+        __m512i i = is_signed ? _mm512_cvtepi16_epi32(_mm256_sra_epi16(s, _mm_cvtsi32_si128(right)))
+                              : _mm512_cvtepu16_epi32(_mm256_srl_epi16(s, _mm_cvtsi32_si128(right)));
+        return _mm512_cvtepi32_ps(i);
+    }
+    inline void store_samples(uint16_t* p) const {
+        _mm256_storeu_si256((__m256i*)p, _mm512_cvtepi32_epi16(_mm512_cvttps_epi32(v)));
+    }
+
+    inline friend float hmax(floatx a) { return _mm512_reduce_max_ps(a.v); }
+
+    inline friend floatx operator +(floatx a, floatx b) { return _mm512_add_ps(a.v, b.v); }
+    inline friend floatx operator -(floatx a, floatx b) { return _mm512_sub_ps(a.v, b.v); }
+    inline friend floatx operator *(floatx a, floatx b) { return _mm512_mul_ps(a.v, b.v); }
+    inline friend floatx operator /(floatx a, floatx b) { return _mm512_div_ps(a.v, b.v); }
+    inline friend floatx operator -(floatx a) { return _mm512_sub_ps(_mm512_setzero_ps(), a.v); }
+    inline friend floatx sqrt(floatx a) { return _mm512_sqrt_ps(a.v); }
+    inline friend floatx min(floatx a, floatx b) { return _mm512_min_ps(a.v, b.v); }
+    inline friend floatx max(floatx a, floatx b) { return _mm512_max_ps(a.v, b.v); }
+    inline friend floatx abs(floatx a) { return _mm512_abs_ps(a.v); }
+    inline friend maskx<16> operator <(floatx a, floatx b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+    inline friend maskx<16> operator >(floatx a, floatx b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ) }; }
+    inline friend maskx<16> operator <=(floatx a, floatx b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ) }; }
+    inline friend maskx<16> operator >=(floatx a, floatx b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ) }; }
+    inline friend floatx select(maskx<16> m, floatx a, floatx b) { return _mm512_mask_blend_ps(m.m, b.v, a.v); }
+
+    FLOATX_COMMON
+};
+#endif
+
+#undef FLOATX_COMMON
+
+// Applies a scalar function lane by lane, for functions without a vector version
+template <int N, class F>
+inline floatx<N> map_lanes(floatx<N> a, F f) {
+    alignas(64) float lanes[N];
+    a.store(lanes);
+    for (int i = 0; i < N; i++) lanes[i] = f(lanes[i]);
+    return floatx<N>::load(lanes);
+}
+
+// approx_* from the fast math region for every lane. Widths that are a
+// multiple of four go through the four lane versions, four lanes at a time,
+// others through the scalar ones lane by lane. Those are global and hidden by
+// these templates inside the namespace, hence the :: qualification.
+template <int N>
+inline floatx<N> approx_log2(floatx<N> x) {
+    alignas(64) float lanes[N];
+    x.store(lanes);
+#if defined(__SSE2__) || defined(_M_X64)
+    if constexpr (N % 4 == 0) {
+        for (int i = 0; i < N; i += 4) _mm_store_ps(lanes + i, ::approx_log2(_mm_load_ps(lanes + i)));
+        return floatx<N>::load(lanes);
+    }
+#endif
+    for (int i = 0; i < N; i++) lanes[i] = ::approx_log2(lanes[i]);
+    return floatx<N>::load(lanes);
+}
+
+template <int N>
+inline floatx<N> approx_pow(floatx<N> a, floatx<N> b) {
+    alignas(64) float a_lanes[N];
+    alignas(64) float b_lanes[N];
+    a.store(a_lanes);
+    b.store(b_lanes);
+#if defined(__SSE2__) || defined(_M_X64)
+    if constexpr (N % 4 == 0) {
+        for (int i = 0; i < N; i += 4) _mm_store_ps(a_lanes + i, ::approx_pow(_mm_load_ps(a_lanes + i), _mm_load_ps(b_lanes + i)));
+        return floatx<N>::load(a_lanes);
+    }
+#endif
+    for (int i = 0; i < N; i++) a_lanes[i] = ::approx_pow(a_lanes[i], b_lanes[i]);
+    return floatx<N>::load(a_lanes);
+}
+
+template <int N>
+inline void approx_sincos(floatx<N> x, floatx<N>& s, floatx<N>& c) {
+    alignas(64) float x_lanes[N];
+    alignas(64) float s_lanes[N];
+    alignas(64) float c_lanes[N];
+    x.store(x_lanes);
+#if defined(__SSE2__) || defined(_M_X64)
+    if constexpr (N % 4 == 0) {
+        for (int i = 0; i < N; i += 4) {
+            __m128 s4, c4;
+            ::approx_sincos(_mm_load_ps(x_lanes + i), s4, c4);
+            _mm_store_ps(s_lanes + i, s4);
+            _mm_store_ps(c_lanes + i, c4);
+        }
+        s = floatx<N>::load(s_lanes);
+        c = floatx<N>::load(c_lanes);
+        return;
+    }
+#endif
+    for (int i = 0; i < N; i++) ::approx_sincos(x_lanes[i], s_lanes[i], c_lanes[i]);
+    s = floatx<N>::load(s_lanes);
+    c = floatx<N>::load(c_lanes);
+}
+
+// fast_* for every lane, libm lane by lane without MIR_FAST_MATH
+#ifdef MIR_FAST_MATH
+template <int N> inline floatx<N> fast_log2(floatx<N> x) { return approx_log2(x); }
+template <int N> inline floatx<N> fast_pow(floatx<N> a, floatx<N> b) { return approx_pow(a, b); }
+template <int N> inline void fast_sincos(floatx<N> x, floatx<N>& s, floatx<N>& c) { approx_sincos(x, s, c); }
+#else
+template <int N> inline floatx<N> fast_log2(floatx<N> x) { return map_lanes(x, [](float l) { return log2f(l); }); }
+template <int N>
+inline floatx<N> fast_pow(floatx<N> a, floatx<N> b) {
+    alignas(64) float a_lanes[N];
+    alignas(64) float b_lanes[N];
+    a.store(a_lanes);
+    b.store(b_lanes);
+    for (int i = 0; i < N; i++) a_lanes[i] = powf(a_lanes[i], b_lanes[i]);
+    return floatx<N>::load(a_lanes);
+}
+template <int N>
+inline void fast_sincos(floatx<N> x, floatx<N>& s, floatx<N>& c) {
+    s = map_lanes(x, [](float l) { return sinf(l); });
+    c = map_lanes(x, [](float l) { return cosf(l); });
+}
+#endif
+
+template <int N>
+struct float3x {
+    floatx<N> x, y, z;
+
+    inline float3x() {}
+    explicit inline float3x(floatx<N> s) : x(s), y(s), z(s) {}
+    inline float3x(floatx<N> x, floatx<N> y, floatx<N> z) : x(x), y(y), z(z) {}
+
+    static inline float3x load(const float* x, const float* y, const float* z) {
+        return float3x(floatx<N>::load(x), floatx<N>::load(y), floatx<N>::load(z));
+    }
+    inline void store(float* x, float* y, float* z) const {
+        this->x.store(x);
+        this->y.store(y);
+        this->z.store(z);
+    }
+
+    inline friend float3x operator +(const float3x& a, const float3x& b) { return float3x(a.x + b.x, a.y + b.y, a.z + b.z); }
+    inline friend float3x operator -(const float3x& a, const float3x& b) { return float3x(a.x - b.x, a.y - b.y, a.z - b.z); }
+    inline friend float3x operator *(const float3x& a, const float3x& b) { return float3x(a.x * b.x, a.y * b.y, a.z * b.z); }
+    inline friend float3x operator *(const float3x& a, floatx<N> s) { return float3x(a.x * s, a.y * s, a.z * s); }
+    inline friend float3x operator *(floatx<N> s, const float3x& a) { return a * s; }
+    inline friend float3x operator /(const float3x& a, floatx<N> s) { return float3x(a.x / s, a.y / s, a.z / s); }
+    inline friend float3x operator -(const float3x& a) { return float3x(-a.x, -a.y, -a.z); }
+
+    inline friend floatx<N> dot(const float3x& a, const float3x& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline friend float3x cross(const float3x& a, const float3x& b) {
+        return float3x(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+    }
+    inline friend floatx<N> length(const float3x& a) { return sqrt(dot(a, a)); }
+    inline friend float3x normalize(const float3x& a) { return a / sqrt(dot(a, a)); }
+    inline friend float3x lerp(const float3x& a, const float3x& b, floatx<N> t) {
+        return float3x(lerp(a.x, b.x, t), lerp(a.y, b.y, t), lerp(a.z, b.z, t));
+    }
+    inline friend float3x select(maskx<N> m, const float3x& a, const float3x& b) {
+        return float3x(select(m, a.x, b.x), select(m, a.y, b.y), select(m, a.z, b.z));
+    }
+};
+
+} // inline namespace MATH_WIDE_NAMESPACE
+#pragma endregion
+
 #undef rpt2
 #undef rpt3
 #undef rpt4
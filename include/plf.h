@@ -3,6 +3,7 @@
 
 #include "disney.h"
 
+#include <cassert>
 #include <vector>
 #include <utility>
 
@@ -11,11 +12,46 @@ private:
     // TODO: btree opt
     std::vector<std::pair<uint16_t, DisneyMaterial>> nodes;
 
+    // One prepared material per possible sample value, filled in by bake()
+    std::vector<PreparedMaterial> baked;
+    // 1 - Transmission per sample value, small enough to stay in cache while
+    // marching. Half precision keeps density > 0 exactly when Transmission < 1.
+    std::vector<half> density;
+    bool emissive;
+
 public:
     PLF(DisneyMaterial first, DisneyMaterial second);
     void add_material(uint16_t value, DisneyMaterial node);
 
+    // Evaluates the transfer function for every sample value up front. Has to
+    // be called again after add_material, which drops the baked tables, before
+    // any of the lookups below.
+    void bake();
+
     DisneyMaterial get_material_for(uint16_t sample);
+
+    // Whether any sample value maps to an emissive material, only valid once
+    // the PLF has been baked
+    inline bool has_emission() const {
+        assert(!baked.empty() && "PLF used before bake()");
+        return emissive;
+    }
+
+    // Only valid once the PLF has been baked
+    inline const PreparedMaterial& get_prepared_for(uint16_t sample) const {
+        assert(!baked.empty() && "PLF used before bake()");
+        return baked[sample];
+    }
+    inline float get_density_for(uint16_t sample) const {
+        assert(!density.empty() && "PLF used before bake()");
+        return density[sample];
+    }
+    // Same as get_density_for(sample) > 0, density is never negative so the
+    // half's bits can be tested without converting it
+    inline bool has_density(uint16_t sample) const {
+        assert(!density.empty() && "PLF used before bake()");
+        return density[sample].bits != 0;
+    }
 };
 
 #endif
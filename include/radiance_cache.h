@@ -0,0 +1,40 @@
+#ifndef RADIANCE_CACHE_H
+#define RADIANCE_CACHE_H
+
+#include "math.hpp"
+
+#include <vector>
+
+// World-space radiance cache. Positions are quantized into cells of
+// cell_size and bucketed by the dominant axis of the surface normal, so both
+// sides of a thin structure don't share an entry. Cells are stored in an open
+// addressed hash table that never grows; inserts into a full neighbourhood
+// are dropped.
+class RadianceCache {
+private:
+    struct Entry {
+        uint64_t key;
+        float3 radiance;
+        uint32_t count;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t mask;
+    float cell_size_recp;
+    uint32_t min_samples;
+
+    uint64_t get_key(float3 position, float3 normal);
+    Entry* find(uint64_t key, bool insert);
+
+public:
+    RadianceCache(float cell_size, uint32_t log2_capacity, uint32_t min_samples);
+
+    // Accumulates an outgoing radiance estimate for the cell containing position
+    void insert(float3 position, float3 normal, float3 radiance);
+
+    // Returns true and the averaged radiance if the cell has at least
+    // min_samples estimates in it
+    bool lookup(float3 position, float3 normal, float3& radiance);
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable task_available;
+    std::condition_variable task_done;
+    size_t active;
+    bool stopping;
+
+    void worker_loop();
+
+public:
+    // Spawns num_threads workers, or one per hardware thread if zero
+    explicit ThreadPool(size_t num_threads = 0);
+    ~ThreadPool();
+
+    size_t size();
+
+    void enqueue(std::function<void()> task);
+
+    // Blocks until every queued task has finished
+    void wait();
+
+    // Runs body(i) for every i in [0, count) and waits for all of them
+    void parallel_for(size_t count, const std::function<void(size_t)>& body);
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef VOLUME_CACHE_H
+#define VOLUME_CACHE_H
+
+#include "math.hpp"
+#include "Dicom.hpp"
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Preprocessed volume written next to the DICOM files after the first load,
+// so later runs map it instead of parsing the whole folder again. The file is
+// the header followed by the voxels, slice after slice, at data_offset.
+#define MIRVOL_MAGIC "MIRVOL\0\0"
+#define MIRVOL_VERSION 1
+
+struct MirvolHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    float size[3]; // meters
+    double spacing[3]; // millimeters
+    uint16_t max_value;
+    uint16_t pad[3];
+    uint64_t signature;
+    uint64_t data_offset; // page aligned so the voxels can be mapped as is
+};
+
+// A mapped .mirvol or segment. data points into the mapping, which stays
+// valid until UnmapVolumeCache is called.
+struct MappedVolume {
+    MirvolHeader header;
+    uint16_t* data;
+    void* mapping;
+    size_t mapping_size;
+
+    // Segments only: the lock that counts this process as attached on POSIX,
+    // the handle that keeps the segment alive on Windows
+    uint64_t segment_signature;
+#ifdef _WIN32
+    void* segment_handle;
+#else
+    int segment_lock;
+#endif
+};
+
+// volume.mirvol, or volume-<hash of the series UID>.mirvol so every series in
+// a folder gets its own cache
+std::string MirvolFilename(const std::string& series);
+
+// Hashes the name, size and modification time of every source file, in sorted
+// order, together with the load options. Reading the contents would cost as much as loading,
+// any rewrite of a file changes its size or time.
+uint64_t VolumeSourceSignature(const std::vector<std::string>& files, uint64_t options);
+
+// Maps path read only and checks it against signature. Returns false if the
+// file is missing, truncated, from another version or out of date. Processes
+// mapping the same file share one copy of the voxels in the page cache.
+bool MapVolumeCache(const std::string& path, uint64_t signature, MappedVolume& mapped);
+void UnmapVolumeCache(MappedVolume& mapped);
+
+// Named shared memory holding the same layout as a .mirvol file, for studies
+// whose folder cannot be written to. Mapped segments are released by
+// UnmapVolumeCache. On POSIX, attached processes are counted with a shared
+// flock on a lock file in the temp folder and the last one to detach unlinks
+// the segment, a segment left by a crash is unlinked by the next process that
+// attaches to it and detaches. On Windows the segment lives as long as a
+// process has it mapped.
+std::string VolumeSegmentName(uint64_t signature);
+bool MapVolumeSegment(uint64_t signature, MappedVolume& mapped);
+// Creates the segment and leaves this process attached to it through mapped.
+// Fails if the segment already exists, a concurrent creator wins the race.
+bool CreateVolumeSegment(uint64_t signature, const Volume& volume, double3 spacing, uint16_t max_value, MappedVolume& mapped);
+
+// Calls write on a uniquely named temporary file next to path, syncs it to
+// disk and renames it over path. Readers and concurrent writers only ever see
+// a complete file. Returns false, leaving path alone, if anything fails.
+bool WriteFileAtomic(const std::string& path, const std::function<bool(FILE* file)>& write);
+
+// Writes the cache through WriteFileAtomic, so a concurrent run never maps a
+// partial cache
+bool WriteVolumeCache(const std::string& path, uint64_t signature, const Volume& volume, double3 spacing, uint16_t max_value);
+
+#endif
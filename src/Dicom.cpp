@@ -6,33 +6,460 @@
 
 #include "Dicom.hpp"
 #include "filesystem.hpp"
+#include "file_reader.h"
+#include "kernels.h"
+#include "volume_cache.h"
 
 #include <dcmtk/dcmimgle/dcmimage.h>
 #include <dcmtk/dcmdata/dctk.h>
+#include <dcmtk/dcmdata/dcrledrg.h>
+#include <dcmtk/dcmjpeg/djdecode.h>
+#include <dcmtk/dcmjpls/djdecode.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
 #include <vector>
 
 using namespace std;
 
+#define SERIES_INDEX_FILENAME "series.mirindex"
+#define SERIES_INDEX_VERSION 2
+#define READS_IN_FLIGHT 64 // slice files read ahead of the decoding workers
+
+// Registers the JPEG, JPEG-LS and RLE decoders on first use and removes them
+// at exit. DicomImage and chooseRepresentation then decompress transparently,
+// each slice on the worker that decodes it.
+struct CodecRegistration {
+    CodecRegistration() {
+        DJDecoderRegistration::registerCodecs();
+        DJLSDecoderRegistration::registerCodecs();
+        DcmRLEDecoderRegistration::registerCodecs();
+    }
+
+    ~CodecRegistration() {
+        DJDecoderRegistration::cleanup();
+        DJLSDecoderRegistration::cleanup();
+        DcmRLEDecoderRegistration::cleanup();
+    }
+};
+
+static void RegisterCodecs() {
+    static CodecRegistration registration;
+}
+
+// Everything needed to size the volume and order the slices, read without
+// touching the pixel data
 struct Slice {
-    DicomImage* image;
+    string file;
+    string series; // SeriesInstanceUID
     double3 spacing;
     double location;
+    uint32_t width;
+    uint32_t height;
+    uint32_t frames; // NumberOfFrames, enhanced multi-frame objects hold many slices
+    // Frame of a multi-frame object this slice was expanded from, with its
+    // own modality rescale
+    uint32_t frame;
+    double slope;
+    double intercept;
+    // Size and modification time the header was read at, index entries are
+    // reused while both still match the file
+    uint64_t file_size;
+    int64_t file_time;
 };
 
-Slice ReadDicomSlice(const string& file) {
+bool ReadSliceHeader(const string& file, Slice& slice) {
+    DcmFileFormat fileFormat;
+    if (fileFormat.loadFileUntilTag(file.c_str(), EXS_Unknown, EGL_noChange, DCM_MaxReadLength, ERM_autoDetect, DCM_PixelData).bad()) {
+        return false;
+    }
+    DcmDataset* dataset = fileFormat.getDataset();
+
+    slice.file = file;
+
+    OFString series;
+    dataset->findAndGetOFString(DCM_SeriesInstanceUID, series);
+    slice.series = series.c_str();
+
+    slice.spacing = 0;
+    dataset->findAndGetFloat64(DCM_PixelSpacing, slice.spacing.x, 0);
+    dataset->findAndGetFloat64(DCM_PixelSpacing, slice.spacing.y, 1);
+    dataset->findAndGetFloat64(DCM_SliceThickness, slice.spacing.z, 0);
+
+    // SliceLocation is optional, the z of ImagePositionPatient orders axial
+    // stacks the same way
+    slice.location = 0;
+    if (dataset->findAndGetFloat64(DCM_SliceLocation, slice.location, 0).bad()) {
+        dataset->findAndGetFloat64(DCM_ImagePositionPatient, slice.location, 2);
+    }
+
+    Uint16 rows = 0, columns = 0;
+    dataset->findAndGetUint16(DCM_Rows, rows);
+    dataset->findAndGetUint16(DCM_Columns, columns);
+    slice.width = columns;
+    slice.height = rows;
+
+    Sint32 frames = 1;
+    dataset->findAndGetSint32(DCM_NumberOfFrames, frames);
+    slice.frames = frames > 1 ? (uint32_t)frames : 1;
+    slice.frame = 0;
+    slice.slope = 1;
+    slice.intercept = 0;
+    return true;
+}
+
+// Reads the geometry and rescale of one frame from its functional group
+// item, keeping the values already in slice for anything it does not hold
+static void ReadFrameGroup(DcmItem* group, Slice& slice) {
+    DcmItem* item = nullptr;
+    if (group->findAndGetSequenceItem(DCM_PixelMeasuresSequence, item, 0).good() && item != nullptr) {
+        item->findAndGetFloat64(DCM_PixelSpacing, slice.spacing.x, 0);
+        item->findAndGetFloat64(DCM_PixelSpacing, slice.spacing.y, 1);
+        item->findAndGetFloat64(DCM_SliceThickness, slice.spacing.z, 0);
+    }
+    if (group->findAndGetSequenceItem(DCM_PlanePositionSequence, item, 0).good() && item != nullptr) {
+        item->findAndGetFloat64(DCM_ImagePositionPatient, slice.location, 2);
+    }
+    if (group->findAndGetSequenceItem(DCM_PixelValueTransformationSequence, item, 0).good() && item != nullptr) {
+        item->findAndGetFloat64(DCM_RescaleSlope, slice.slope);
+        item->findAndGetFloat64(DCM_RescaleIntercept, slice.intercept);
+    }
+}
+
+// Appends one slice per frame of an enhanced multi-frame object, using the
+// shared and per-frame functional groups for spacing, position and rescale.
+// Only the header is read, the groups all come before PixelData.
+static bool ExpandFrames(const Slice& object, vector<Slice>& slices) {
     DcmFileFormat fileFormat;
-    fileFormat.loadFile(file.c_str());
+    if (fileFormat.loadFileUntilTag(object.file.c_str(), EXS_Unknown, EGL_noChange, DCM_MaxReadLength, ERM_autoDetect, DCM_PixelData).bad()) {
+        return false;
+    }
+    DcmDataset* dataset = fileFormat.getDataset();
+
+    Slice shared = object;
+    DcmItem* group = nullptr;
+    if (dataset->findAndGetSequenceItem(DCM_SharedFunctionalGroupsSequence, group, 0).good() && group != nullptr) {
+        ReadFrameGroup(group, shared);
+    }
+
+    for (uint32_t i = 0; i < object.frames; i++) {
+        Slice frame = shared;
+        frame.frame = i;
+        if (dataset->findAndGetSequenceItem(DCM_PerFrameFunctionalGroupsSequence, group, i).bad() || group == nullptr) {
+            cerr << object.file << " has no functional groups for frame " << i << endl;
+            return false;
+        }
+        ReadFrameGroup(group, frame);
+        slices.push_back(frame);
+    }
+    return true;
+}
+
+// Where the value sits in each 16 bit stored sample. Writers are free to
+// leave overlays or garbage above HighBit, so those bits are always dropped.
+static bool ReadStoredBits(DcmDataset* dataset, const string& file, uint32_t& bits_stored, uint32_t& high_bit) {
+    Uint16 bits = 16, high = 0;
+    dataset->findAndGetUint16(DCM_BitsStored, bits);
+    if (dataset->findAndGetUint16(DCM_HighBit, high).bad()) high = bits - 1;
+    if (bits == 0 || high > 15 || bits > high + 1) {
+        cerr << file << " has BitsStored " << bits << " and HighBit " << high << ", which do not fit 16 bits" << endl;
+        return false;
+    }
+
+    bits_stored = bits;
+    high_bit = high;
+    return true;
+}
+
+// Reads frames of multi-frame objects one at a time. Only the header is held
+// in memory: getUncompressedFrame reads and, if compressed, decodes just the
+// fragments of the requested frame, through a file cache that keeps the file
+// open between frames. Each worker has its own reader, DCMTK datasets are not
+// safe to share between threads.
+struct FrameReader {
+    string file;
+    std::unique_ptr<DcmFileFormat> fileFormat;
+    DcmFileCache cache;
+    DcmPixelData* pixel_data = nullptr;
+    uint32_t bits_stored = 16;
+    uint32_t high_bit = 15;
+    bool is_signed = false;
+    // Where the next frame starts among the compressed fragments, valid while
+    // frames are read in order
+    Uint32 next_frame = 0;
+    Uint32 start_fragment = 0;
+    vector<Uint16> stored;
+};
+
+static bool OpenFrames(const Slice& slice, FrameReader& reader) {
+    reader.file = slice.file;
+    reader.pixel_data = nullptr;
+    reader.next_frame = 0;
+    reader.start_fragment = 0;
+
+    // Values longer than DCM_MaxReadLength, the pixel data among them, are
+    // left on disk until they are asked for. The cache notices the file
+    // changed and reopens it.
+    reader.fileFormat.reset(new DcmFileFormat());
+    if (reader.fileFormat->loadFile(slice.file.c_str()).bad()) {
+        return false;
+    }
+    DcmDataset* dataset = reader.fileFormat->getDataset();
+
+    Uint16 bits_allocated = 0, samples_per_pixel = 1, pixel_representation = 0;
+    dataset->findAndGetUint16(DCM_BitsAllocated, bits_allocated);
+    dataset->findAndGetUint16(DCM_SamplesPerPixel, samples_per_pixel);
+    dataset->findAndGetUint16(DCM_PixelRepresentation, pixel_representation);
+    if (bits_allocated != 16 || samples_per_pixel != 1) {
+        cerr << slice.file << " is not a 16 bit single sample image" << endl;
+        return false;
+    }
+    if (!ReadStoredBits(dataset, slice.file, reader.bits_stored, reader.high_bit)) {
+        return false;
+    }
+    reader.is_signed = pixel_representation == 1;
+
+    DcmElement* element = nullptr;
+    if (dataset->findAndGetElement(DCM_PixelData, element).bad() || element == nullptr) {
+        return false;
+    }
+    reader.pixel_data = OFstatic_cast(DcmPixelData*, element);
+    reader.stored.resize((size_t)slice.width * slice.height);
+    return true;
+}
+
+// Decodes one frame and rescales it with the kernel. Without raw_hounsfield
+// the frame is windowed to its own min/max over the full output range, which
+// is what setMinMaxWindow does for single frame files.
+static bool ReadFrame(FrameReader& reader, const Slice& slice, bool raw_hounsfield, uint16_t* pixels, uint16_t& max_value) {
+    if (reader.file != slice.file && !OpenFrames(slice, reader)) {
+        reader.file.clear();
+        return false;
+    }
+
+    if (slice.frame != reader.next_frame) {
+        reader.start_fragment = 0;
+    }
+
+    OFString color_model;
+    const size_t frame_size = (size_t)slice.width * slice.height;
+    OFCondition status = reader.pixel_data->getUncompressedFrame(reader.fileFormat->getDataset(), slice.frame, reader.start_fragment,
+        reader.stored.data(), (Uint32)(frame_size * sizeof(Uint16)), color_model, &reader.cache);
+    if (status.bad()) {
+        cerr << "Could not decode frame " << slice.frame << " of " << slice.file << ": " << status.text() << endl;
+        return false;
+    }
+    reader.next_frame = slice.frame + 1;
+
+    const uint16_t* stored = reader.stored.data();
+    double slope = slice.slope;
+    double intercept = slice.intercept;
+    if (!raw_hounsfield) {
+        int left = 15 - (int)reader.high_bit;
+        int right = 16 - (int)reader.bits_stored;
+        int32_t low = INT32_MAX, high = INT32_MIN;
+        for (size_t i = 0; i < frame_size; i++) {
+            uint16_t s = (uint16_t)(stored[i] << left);
+            int32_t v = reader.is_signed ? (int16_t)s >> right : s >> right;
+            low = v < low ? v : low;
+            high = v > high ? v : high;
+        }
+
+        slope = high > low ? 65535. / (high - low) : 0.;
+        intercept = -low * slope - DICOM_HU_OFFSET;
+    }
+
+    max_value = kernels().rescale_hounsfield(stored, reader.bits_stored, reader.high_bit, reader.is_signed, (float)slope, (float)intercept, pixels, frame_size);
+    return true;
+}
+
+static void GetFileStamp(const string& file, uint64_t& file_size, int64_t& file_time) {
+    std::error_code error;
+    file_size = (uint64_t)filesystem::file_size(file, error);
+    file_time = (int64_t)filesystem::last_write_time(file, error).time_since_epoch().count();
+}
+
+// The index is a text file with one tab separated line per file, keyed by
+// file name so the folder can be moved
+static void ReadSeriesIndex(const string& path, unordered_map<string, Slice>& entries) {
+    ifstream in(path);
+    string line;
+    if (!getline(in, line) || line != "mirindex " + to_string(SERIES_INDEX_VERSION)) return;
+
+    while (getline(in, line)) {
+        istringstream fields(line);
+        Slice slice;
+        string name;
+        fields >> slice.file_size >> slice.file_time >> slice.spacing.x >> slice.spacing.y >> slice.spacing.z
+            >> slice.location >> slice.width >> slice.height >> slice.frames >> slice.series;
+        if (fields.fail() || fields.get() != '\t' || !getline(fields, name)) continue;
+        if (slice.series == "-") slice.series.clear();
+        slice.frame = 0;
+        slice.slope = 1;
+        slice.intercept = 0;
+        entries[name] = slice;
+    }
+}
+
+static void WriteSeriesIndex(const string& path, const vector<Slice>& slices) {
+    ostringstream out;
+    out << "mirindex " << SERIES_INDEX_VERSION << "\n";
+    out.precision(17);
+    for (const auto& i : slices) {
+        out << i.file_size << '\t' << i.file_time << '\t' << i.spacing.x << '\t' << i.spacing.y << '\t' << i.spacing.z << '\t'
+            << i.location << '\t' << i.width << '\t' << i.height << '\t' << i.frames << '\t' << (i.series.empty() ? "-" : i.series) << '\t'
+            << filesystem::path(i.file).filename().string() << "\n";
+    }
+
+    // Same unique temp file and rename as the volume cache, so runs indexing
+    // the folder at once never write into each other's index
+    string index = out.str();
+    bool written = WriteFileAtomic(path, [&](FILE* file) {
+        return fwrite(index.data(), 1, index.size(), file) == index.size();
+    });
+    if (!written) {
+        cerr << "Could not write series index " << path << endl;
+    }
+}
+
+// Headers of every file, reusing the on-disk index for files that have not
+// changed since it was written and reading the rest on the pool
+static bool IndexSlices(const string& folder, const vector<string>& files, ThreadPool& pool, vector<Slice>& slices) {
+    string index_path = (filesystem::path(folder) / SERIES_INDEX_FILENAME).string();
+    unordered_map<string, Slice> entries;
+    ReadSeriesIndex(index_path, entries);
+
+    slices.resize(files.size());
+    std::atomic<bool> failed(false);
+    std::atomic<size_t> misses(0);
+    pool.parallel_for(files.size(), [&](size_t i) {
+        uint64_t file_size;
+        int64_t file_time;
+        GetFileStamp(files[i], file_size, file_time);
+
+        auto entry = entries.find(filesystem::path(files[i]).filename().string());
+        if (entry != entries.end() && entry->second.file_size == file_size && entry->second.file_time == file_time) {
+            slices[i] = entry->second;
+            slices[i].file = files[i];
+            return;
+        }
+
+        misses++;
+        if (!ReadSliceHeader(files[i], slices[i])) {
+            cerr << "FATAL: Failed to read " << files[i] << endl;
+            failed = true;
+        }
+        slices[i].file_size = file_size;
+        slices[i].file_time = file_time;
+    });
+
+    if (failed) return false;
+
+    if (misses > 0 || entries.size() != files.size()) {
+        WriteSeriesIndex(index_path, slices);
+    }
+    return true;
+}
+
+// Keeps only the slices of series, or of the largest series if it is empty
+static bool SelectSeries(const string& series, vector<Slice>& slices) {
+    unordered_map<string, size_t> counts;
+    for (const auto& i : slices) counts[i.series]++;
+
+    string selected = series;
+    if (selected.empty()) {
+        size_t largest = 0;
+        for (const auto& i : counts) {
+            if (i.second > largest || (i.second == largest && i.first < selected)) {
+                largest = i.second;
+                selected = i.first;
+            }
+        }
+
+        if (counts.size() > 1) {
+            cout << "Found " << counts.size() << " series, loading the largest one" << endl;
+            for (const auto& i : counts) {
+                cout << "  " << i.first << ": " << i.second << " slices" << endl;
+            }
+        }
+    } else if (counts.find(selected) == counts.end()) {
+        cerr << "Series " << selected << " not found" << endl;
+        return false;
+    }
+
+    slices.erase(std::remove_if(slices.begin(), slices.end(), [&](const Slice& i) {
+            return i.series != selected;
+            }), slices.end());
+    return true;
+}
+
+// Parses a whole file that has already been read into memory
+static bool ParseSliceFile(const uint8_t* data, size_t size, DcmFileFormat& fileFormat) {
+    DcmInputBufferStream stream;
+    stream.setBuffer(data, (offile_off_t)size);
+    stream.setEos();
+
+    fileFormat.transferInit();
+    OFCondition status = fileFormat.read(stream);
+    fileFormat.transferEnd();
+    return status.good();
+}
+
+// Renders the parsed file straight into pixels, which has to hold width *
+// height values. The DicomImage takes over the file format and both are
+// released before returning.
+bool ReadDicomSlice(const Slice& slice, DcmFileFormat* fileFormat, uint16_t* pixels) {
+    DicomImage image(fileFormat, fileFormat->getDataset()->getOriginalXfer(), CIF_TakeOverExternalDataset);
+    if (image.getStatus() != EIS_Normal || image.getWidth() != slice.width || image.getHeight() != slice.height) {
+        return false;
+    }
+
+    image.setMinMaxWindow();
+    return image.getOutputData(pixels, (unsigned long)slice.width * slice.height * sizeof(uint16_t), 16) != 0;
+}
+
+// Reads the stored pixel values without going through DicomImage and rescales
+// them to Hounsfield units, max_value is the largest value written. Only
+// single sample, 16 bit images are supported. The value is taken from the
+// BitsStored bits ending at HighBit and sign extended from there when signed.
+bool ReadRawSlice(const Slice& slice, DcmFileFormat& fileFormat, uint16_t* pixels, uint16_t& max_value) {
     DcmDataset* dataset = fileFormat.getDataset();
 
-    double3 s = 0;
-    dataset->findAndGetFloat64(DCM_PixelSpacing, s.x, 0);
-    dataset->findAndGetFloat64(DCM_PixelSpacing, s.y, 1);
-    dataset->findAndGetFloat64(DCM_SliceThickness, s.z, 0);
+    Uint16 bits_allocated = 0, samples_per_pixel = 1, pixel_representation = 0;
+    dataset->findAndGetUint16(DCM_BitsAllocated, bits_allocated);
+    dataset->findAndGetUint16(DCM_SamplesPerPixel, samples_per_pixel);
+    dataset->findAndGetUint16(DCM_PixelRepresentation, pixel_representation);
+    if (bits_allocated != 16 || samples_per_pixel != 1) {
+        cerr << slice.file << " is not a 16 bit single sample image" << endl;
+        return false;
+    }
+    uint32_t bits_stored, high_bit;
+    if (!ReadStoredBits(dataset, slice.file, bits_stored, high_bit)) {
+        return false;
+    }
 
-    double x = 0;
-    dataset->findAndGetFloat64(DCM_SliceLocation, x, 0);
+    // Compressed pixel data is decoded in place before it can be read
+    if (dataset->chooseRepresentation(EXS_LittleEndianExplicit, nullptr).bad()) {
+        cerr << "Unsupported transfer syntax in " << slice.file << endl;
+        return false;
+    }
 
-    return { new DicomImage(file.c_str()), s, x };
+    double slope = 1, intercept = 0;
+    dataset->findAndGetFloat64(DCM_RescaleSlope, slope);
+    dataset->findAndGetFloat64(DCM_RescaleIntercept, intercept);
+
+    const Uint16* stored = nullptr;
+    unsigned long count = 0;
+    const size_t slice_size = (size_t)slice.width * slice.height;
+    if (dataset->findAndGetUint16Array(DCM_PixelData, stored, &count).bad() || stored == nullptr || count < slice_size) {
+        return false;
+    }
+
+    max_value = kernels().rescale_hounsfield(stored, bits_stored, high_bit, pixel_representation == 1, (float)slope, (float)intercept, pixels, slice_size);
+    return true;
 }
 
 Dicom::Dicom() {
@@ -42,86 +469,185 @@ Dicom::Dicom() {
     volume.depth = 0;
     volume.size = 0;
     max_value = 0;
+    mapped = nullptr;
 }
 
 Dicom::~Dicom() {
-    delete[] volume.data;
+    ReleaseVolume();
+}
+
+void Dicom::ReleaseVolume() {
+    if (mapped != nullptr) {
+        UnmapVolumeCache(*mapped);
+        delete mapped;
+        mapped = nullptr;
+    } else {
+        delete[] volume.data;
+    }
+    volume.data = nullptr;
 }
 
-int Dicom::LoadDicomStack(const string& folder, float3* size, bool should_mask, uint8_t mask_value) {
+void Dicom::UseMappedVolume(MappedVolume* cache) {
+    ReleaseVolume();
+    mapped = cache;
+    volume.data = cache->data;
+    volume.width = cache->header.width;
+    volume.height = cache->header.height;
+    volume.depth = cache->header.depth;
+    volume.size = float3(cache->header.size[0], cache->header.size[1], cache->header.size[2]);
+    max_value = cache->header.max_value;
+}
+
+int Dicom::LoadDicomStack(const string& folder, const string& series, float3* size, bool should_mask, uint8_t mask_value, bool raw_hounsfield, ThreadPool& pool) {
     if (!filesystem::exists(folder)) {
         printf("Folder does not exist\n");
         return -1;
     }
 
-    double3 maxSpacing = 0;
-    vector<Slice> images = {};
+    vector<string> files = {};
     for (const auto& p : filesystem::directory_iterator(folder))
         if (p.path().extension().string() == ".dcm") {
-            images.push_back(ReadDicomSlice(p.path().string()));
-            if (images[images.size() - 1].spacing.x > maxSpacing.x &&
-                    images[images.size() - 1].spacing.y > maxSpacing.y) {
-                maxSpacing = images[images.size() - 1].spacing;
-            }
+            files.push_back(p.path().string());
+        }
+
+    if (files.empty()) return -1;
+    std::sort(files.begin(), files.end());
+
+    RegisterCodecs();
+
+    // Phase one only reads headers, from the index where it is up to date.
+    // That is enough to pick the series and to size and order the stack.
+    vector<Slice> slices;
+    if (!IndexSlices(folder, files, pool, slices) || !SelectSeries(series, slices)) return -1;
+
+    files.clear();
+    for (const auto& i : slices) files.push_back(i.file);
+
+    bool organ_masks = filesystem::exists(std::filesystem::path(folder) / "mask");
+
+    // Masks change the voxels too, so they are part of the signature
+    vector<string> sources = files;
+    if (should_mask && organ_masks) {
+        for (const auto& p : filesystem::directory_iterator(std::filesystem::path(folder) / "mask"))
+            sources.push_back(p.path().string());
+    }
+    uint64_t options = (uint64_t)raw_hounsfield | (uint64_t)should_mask << 1 | (uint64_t)mask_value << 8;
+    uint64_t signature = VolumeSourceSignature(sources, options);
+    string cache_path = (std::filesystem::path(folder) / MirvolFilename(slices[0].series)).string();
+
+    MappedVolume* cache = new MappedVolume();
+    bool segment = MapVolumeSegment(signature, *cache);
+    if (segment || MapVolumeCache(cache_path, signature, *cache)) {
+        UseMappedVolume(cache);
+
+        cout << "Mapped cached volume " << (segment ? VolumeSegmentName(signature) : cache_path) << endl;
+        if (size) {
+            *size = volume.size;
+            printf("%fm x %fm x %fm\n", size->x, size->y, size->z);
+        }
+        return 0;
+    }
+    delete cache;
+
+    // Enhanced multi-frame objects hold many slices in one file, each of them
+    // is expanded into one slice per frame. Series can mix them with single
+    // frame files.
+    vector<Slice> expanded;
+    for (const auto& i : slices) {
+        if (i.frames <= 1) {
+            expanded.push_back(i);
+        } else if (!ExpandFrames(i, expanded)) {
+            cerr << "FATAL: Failed to read frames of " << i.file << endl;
+            return -1;
         }
+    }
+    slices.swap(expanded);
 
-    if (images.empty()) return -1;
+    double3 maxSpacing = 0;
+    for (const auto& i : slices) {
+        if (i.spacing.x > maxSpacing.x && i.spacing.y > maxSpacing.y) {
+            maxSpacing = i.spacing;
+        }
+    }
 
-    std::sort(images.begin(), images.end(), [](const Slice& a, const Slice& b) {
+    std::sort(slices.begin(), slices.end(), [](const Slice& a, const Slice& b) {
             return a.location < b.location;
             });
 
-    volume.width = images[0].image->getWidth();
-    volume.height = images[0].image->getHeight();
-    volume.depth = (uint32_t)images.size();
+    volume.width = slices[0].width;
+    volume.height = slices[0].height;
+    volume.depth = (uint32_t)slices.size();
 
     if (volume.width == 0 || volume.height == 0) return -1;
 
     // volume size in meters
-    if (size) {
-        double2 b = images[0].location;
-        for (auto i : images) {
-            b.x = (float)fmin(i.location - i.spacing.z * .5, b.x);
-            b.y = (float)fmax(i.location + i.spacing.z * .5, b.y);
-        }
+    double2 b = slices[0].location;
+    for (const auto& i : slices) {
+        b.x = (float)fmin(i.location - i.spacing.z * .5, b.x);
+        b.y = (float)fmax(i.location + i.spacing.z * .5, b.y);
+    }
 
-        *size = float3(.001 * double3(maxSpacing.xy * double2(volume.width, volume.height), b.y - b.x));
-        volume.size = *size;
+    volume.size = float3(.001 * double3(maxSpacing.xy * double2(volume.width, volume.height), b.y - b.x));
+    if (size) {
+        *size = volume.size;
         printf("%fm x %fm x %fm\n", size->x, size->y, size->z);
     }
 
-    if (volume.data != nullptr) {
-        delete[] volume.data;
-    }
+    ReleaseVolume();
 
-    volume.data = new uint16_t[volume.width * volume.height * volume.depth];
-    memset(volume.data, 0, volume.width * volume.height * volume.depth * sizeof(uint16_t));
+    const size_t slice_size = (size_t)volume.width * volume.height;
+    volume.data = new uint16_t[slice_size * volume.depth];
 
-    bool organ_masks = filesystem::exists(std::filesystem::path(folder) / "mask");
     if (organ_masks) {
         cout << "Applying organ masks" << endl;
     }
 
-    for (uint32_t i = 0; i < images.size(); i++) {
-        images[i].image->setMinMaxWindow();
-        uint16_t* pixels = (uint16_t*)images[i].image->getOutputData(16);
+    stbi_set_flip_vertically_on_load(false);
+
+    // Phase two decodes every slice into its final place in the volume and
+    // frees it right away, so at most one slice per worker is alive on top of
+    // the volume and the files read ahead. Each slice keeps its own maximum so
+    // the workers never share anything but the failure flag.
+    vector<uint16_t> slice_max(slices.size(), 0);
+    std::atomic<bool> failed(false);
+    auto decode_slice = [&](size_t i, DcmFileFormat* fileFormat, FrameReader* frames) {
+        uint16_t* pixels = volume.data + i * slice_size;
+        bool decoded = slices[i].width == volume.width && slices[i].height == volume.height;
+        if (frames != nullptr) {
+            decoded = decoded && ReadFrame(*frames, slices[i], raw_hounsfield, pixels, slice_max[i]);
+        } else if (decoded && raw_hounsfield) {
+            decoded = ReadRawSlice(slices[i], *fileFormat, pixels, slice_max[i]);
+            delete fileFormat;
+        } else if (decoded) {
+            decoded = ReadDicomSlice(slices[i], fileFormat, pixels);
+        } else {
+            delete fileFormat;
+        }
+
+        if (!decoded) {
+            cerr << "FATAL: Failed to decode " << slices[i].file << endl;
+            failed = true;
+            return;
+        }
 
         if (should_mask && organ_masks) {
             std::string path = std::string(folder) + "/mask/" + std::to_string(i) + ".png";
 
             int x, y, n;
-            stbi_set_flip_vertically_on_load(false);
             unsigned char* image = stbi_load(path.c_str(), &x, &y, &n, 1);
             if (image == nullptr) {
                 cerr << "Failed to load mask " << path << endl;
                 cerr << stbi_failure_reason() << endl;
-                return -1;
+                failed = true;
+                return;
             }
 
             if (x != volume.width || y != volume.height) {
                 cerr << "FATAL: " << i << ".png has an unexpected size/format" << endl;
                 cerr << "x: " << x << " y: " << y << " n: " << n << endl;
-                return -1;
+                stbi_image_free(image);
+                failed = true;
+                return;
             }
             
             for (size_t mask_y = 0; mask_y < volume.height; mask_y++) {
@@ -129,7 +655,7 @@ int Dicom::LoadDicomStack(const string& folder, float3* size, bool should_mask,
                     size_t index = mask_x + ((size_t)mask_y * volume.width);
 
                     if (image[index] != mask_value) {
-                        pixels[mask_y + mask_x * images[i].image->getWidth()] = 0;
+                        pixels[mask_y + mask_x * volume.width] = 0;
                     }
                 }
             }
@@ -137,20 +663,89 @@ int Dicom::LoadDicomStack(const string& folder, float3* size, bool should_mask,
             stbi_image_free(image);
         }
 
-        for (size_t j = 0; j < volume.width * volume.height; j++) {
-            if (pixels[j] > max_value) {
-                max_value = pixels[j];
+        // The raw and multi-frame paths already found the maximum while rescaling
+        if ((raw_hounsfield || frames != nullptr) && !(should_mask && organ_masks)) return;
+
+        slice_max[i] = 0;
+        for (size_t j = 0; j < slice_size; j++) {
+            if (pixels[j] > slice_max[i]) {
+                slice_max[i] = pixels[j];
             }
         }
+    };
+
+    vector<size_t> frame_slices, file_slices;
+    for (size_t i = 0; i < slices.size(); i++) {
+        (slices[i].frames > 1 ? frame_slices : file_slices).push_back(i);
+    }
+
+    // Frames are split into one run per worker, in file and frame order so
+    // each reader walks its files front to back
+    if (!frame_slices.empty()) {
+        std::sort(frame_slices.begin(), frame_slices.end(), [&](size_t a, size_t b) {
+            return slices[a].file != slices[b].file ? slices[a].file < slices[b].file : slices[a].frame < slices[b].frame;
+        });
+
+        size_t runs = std::min(pool.size(), frame_slices.size());
+        pool.parallel_for(runs, [&](size_t run) {
+            FrameReader reader;
+            size_t end = (run + 1) * frame_slices.size() / runs;
+            for (size_t j = run * frame_slices.size() / runs; j < end && !failed; j++) {
+                decode_slice(frame_slices[j], nullptr, &reader);
+            }
+        });
+    }
+
+    // Slice files are read asynchronously and parsed from memory by whichever
+    // worker is free, in the order the reads complete
+    if (!file_slices.empty() && !failed) {
+        files.clear();
+        for (size_t i : file_slices) files.push_back(slices[i].file);
+
+        bool read = ReadFiles(files, pool, READS_IN_FLIGHT, [&](size_t j, const uint8_t* data, size_t data_size) {
+            if (failed) return;
+
+            size_t i = file_slices[j];
+            DcmFileFormat* fileFormat = new DcmFileFormat();
+            if (!ParseSliceFile(data, data_size, *fileFormat)) {
+                cerr << "FATAL: Failed to parse " << slices[i].file << endl;
+                delete fileFormat;
+                failed = true;
+                return;
+            }
+            decode_slice(i, fileFormat, nullptr);
+        });
 
-        memcpy(volume.data + i * volume.width * volume.height, pixels, volume.width * volume.height * sizeof(uint16_t));
+        if (!read) {
+            cerr << "FATAL: Failed to read slice files" << endl;
+            failed = true;
+        }
     }
 
+    if (failed) return -1;
+
+    max_value = *std::max_element(slice_max.begin(), slice_max.end());
+
     if (organ_masks) {
         cout << "Zeroed out all non-masked samples" << endl;
     }
 
-    for (auto& i : images) delete i.image;
+    // Switch to the mapped copy as well, so this process shares its voxels
+    // with the ones started after it
+    cache = new MappedVolume();
+    bool shared;
+    if (WriteVolumeCache(cache_path, signature, volume, maxSpacing, max_value)) {
+        shared = MapVolumeCache(cache_path, signature, *cache);
+    } else {
+        cerr << "Could not write volume cache " << cache_path << ", using shared memory" << endl;
+        shared = CreateVolumeSegment(signature, volume, maxSpacing, max_value, *cache);
+    }
+
+    if (shared) {
+        UseMappedVolume(cache);
+    } else {
+        delete cache;
+    }
 
     return 0;
 }
@@ -0,0 +1,149 @@
+#include "ao_volume.h"
+
+// Occupancy samples taken per axis inside every level 0 cell
+#define OCCUPANCY_SUBSAMPLES 4
+// Cones spread evenly over the sphere around every cell
+#define NUM_CONES 16
+
+AOVolume::AOVolume() {
+    resolution = 0;
+    extent = 0.f;
+    cell_size = 0.f;
+    max_distance = 0.f;
+}
+
+void AOVolume::build(Volume& volume, PLF& plf, uint32_t resolution, float max_distance, ThreadPool& pool) {
+    this->resolution = resolution;
+    this->max_distance = max_distance;
+
+    // Volume::sample_at maps slices along world y
+    extent = float3(volume.size.x, volume.size.z, volume.size.y);
+    cell_size = fmax(extent.x, fmax(extent.y, extent.z)) / resolution;
+
+    // Same hit criterion as the primary march
+    std::vector<uint8_t> opaque(65536);
+    for (uint32_t i = 0; i < 65536; i++) {
+        opaque[i] = plf.get_material_for((uint16_t)i).Transmission < 1.f;
+    }
+
+    size_t num_cells = (size_t)resolution * resolution * resolution;
+    std::vector<float> base(num_cells);
+    float3 cell_extent = extent / (float)resolution;
+
+    pool.parallel_for(num_cells, [&](size_t i) {
+        uint3 cell = uint3((uint32_t)(i % resolution), (uint32_t)((i / resolution) % resolution), (uint32_t)(i / ((size_t)resolution * resolution)));
+        float3 corner = float3(cell) * cell_extent - extent * 0.5f;
+
+        uint32_t hits = 0;
+        for (uint32_t z = 0; z < OCCUPANCY_SUBSAMPLES; z++) {
+            for (uint32_t y = 0; y < OCCUPANCY_SUBSAMPLES; y++) {
+                for (uint32_t x = 0; x < OCCUPANCY_SUBSAMPLES; x++) {
+                    float3 offset = (float3(uint3(x, y, z)) + 0.5f) / (float)OCCUPANCY_SUBSAMPLES;
+                    hits += opaque[volume.sample_at(corner + offset * cell_extent)];
+                }
+            }
+        }
+
+        base[i] = (float)hits / (OCCUPANCY_SUBSAMPLES * OCCUPANCY_SUBSAMPLES * OCCUPANCY_SUBSAMPLES);
+    });
+
+    occupancy.clear();
+    occupancy.push_back(std::move(base));
+
+    // Box filter down to a single cell
+    for (uint32_t res = resolution / 2; res > 0; res /= 2) {
+        const std::vector<float>& prev = occupancy.back();
+        std::vector<float> level((size_t)res * res * res);
+        uint32_t prev_res = res * 2;
+
+        pool.parallel_for(level.size(), [&](size_t i) {
+            uint32_t x = (uint32_t)(i % res) * 2;
+            uint32_t y = (uint32_t)((i / res) % res) * 2;
+            uint32_t z = (uint32_t)(i / ((size_t)res * res)) * 2;
+
+            float sum = 0.f;
+            for (uint32_t c = 0; c < 8; c++) {
+                sum += prev[(size_t)(z + (c >> 2)) * prev_res * prev_res + (y + ((c >> 1) & 1)) * prev_res + (x + (c & 1))];
+            }
+            level[i] = sum / 8.f;
+        });
+
+        occupancy.push_back(std::move(level));
+    }
+
+    // Fibonacci sphere of cone directions, each cone covering an equal share of the sphere
+    float3 directions[NUM_CONES];
+    for (uint32_t i = 0; i < NUM_CONES; i++) {
+        float y = 1.f - (2.f * i + 1.f) / NUM_CONES;
+        float r = sqrt(1.f - y * y);
+        float phi = i * PI * (3.f - sqrt(5.f));
+        directions[i] = float3(cos(phi) * r, y, sin(phi) * r);
+    }
+    float tan_half_angle = tan(acos(1.f - 2.f / NUM_CONES));
+
+    ao.assign(num_cells, half(1.f));
+    pool.parallel_for(ao.size(), [&](size_t i) {
+        uint3 cell = uint3((uint32_t)(i % resolution), (uint32_t)((i / resolution) % resolution), (uint32_t)(i / ((size_t)resolution * resolution)));
+        float3 center = (float3(cell) + 0.5f) * cell_extent - extent * 0.5f;
+
+        float visibility = 0.f;
+        for (uint32_t c = 0; c < NUM_CONES; c++) {
+            visibility += trace_cone(center, directions[c], tan_half_angle);
+        }
+        visibility /= NUM_CONES;
+
+        // A point on an open flat surface sees half the sphere
+        ao[i] = fmin(1.f, 2.f * visibility);
+    });
+}
+
+float AOVolume::occupancy_at(float3 world_pos, uint32_t level) {
+    uint32_t res = resolution >> level;
+    float3 p = (world_pos / extent + 0.5f) * (float)res;
+    if (p.x < 0 || p.y < 0 || p.z < 0 || p.x >= res || p.y >= res || p.z >= res) {
+        return 0.f;
+    }
+
+    uint3 cell = uint3(p);
+    return occupancy[level][(size_t)cell.z * res * res + cell.y * res + cell.x];
+}
+
+float AOVolume::trace_cone(float3 origin, float3 direction, float tan_half_angle) {
+    uint32_t max_level = (uint32_t)occupancy.size() - 1;
+    float alpha = 0.f;
+
+    // Start one cell out so the cone doesn't occlude itself
+    float t = cell_size;
+    while (t < max_distance && alpha < 0.99f) {
+        float diameter = fmax(cell_size, 2.f * t * tan_half_angle);
+        uint32_t level = (uint32_t)fmin((float)max_level, log2(diameter / cell_size));
+
+        alpha += (1.f - alpha) * occupancy_at(origin + direction * t, level);
+        t += diameter * 0.5f;
+    }
+
+    return 1.f - alpha;
+}
+
+float AOVolume::ao_at(float3 world_pos) const {
+    if (ao.empty()) return 1.f;
+
+    // Trilinear filter between cell centers
+    float3 p = (world_pos / extent + 0.5f) * (float)resolution - 0.5f;
+    p = clamp(p, float3(0.f), float3((float)resolution - 1.001f));
+
+    uint3 c = uint3(p);
+    float3 f = p - float3(c);
+    uint32_t r = resolution;
+
+    auto at = [&](uint32_t x, uint32_t y, uint32_t z) -> float {
+        return ao[(size_t)min(z, r - 1) * r * r + min(y, r - 1) * r + min(x, r - 1)];
+    };
+
+    float x00 = lerp(at(c.x, c.y, c.z), at(c.x + 1, c.y, c.z), f.x);
+    float x10 = lerp(at(c.x, c.y + 1, c.z), at(c.x + 1, c.y + 1, c.z), f.x);
+    float x01 = lerp(at(c.x, c.y, c.z + 1), at(c.x + 1, c.y, c.z + 1), f.x);
+    float x11 = lerp(at(c.x, c.y + 1, c.z + 1), at(c.x + 1, c.y + 1, c.z + 1), f.x);
+
+    return lerp(lerp(x00, x10, f.y), lerp(x01, x11, f.y), f.z);
+}
@@ -43,7 +43,7 @@ Ray Camera::get_ray(int x, int y, bool jitter, Rng &rng) {
 
     Ray ray;
     ray.origin = m_position;
-    ray.direction = normalize(pixel - m_position);
+    ray.direction = fast_normalize(pixel - m_position);
 
     return ray;
 }
\ No newline at end of file
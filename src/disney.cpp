@@ -1,4 +1,5 @@
 #include "disney.h"
+#include "kernels.h"
 #include <iostream>
 
 DisneyMaterial::DisneyMaterial() : pad{ 0 } {
@@ -37,215 +38,71 @@ DisneyMaterial DisneyMaterial::disney_lerp(DisneyMaterial l, DisneyMaterial r, f
 }
 
 float DisneyMaterial::GetPdf(float3 wi, float3 wo) {
-    float aspect = sqrt(1.f - this->Anisotropy * 0.9f);
-
-    float ax = fmax(0.001f, this->Roughness * this->Roughness * (1.f + this->Anisotropy));
-    float ay = fmax(0.001f, this->Roughness * this->Roughness * (1.f - this->Anisotropy));
-    float3 wh = normalize(wo + wi);
-    float ndotwh = abs(wh.y);
-    float hdotwo = abs(dot(wh, wo));
-
-    float d_pdf = abs(wo.y) / PI;
-    float r_pdf = GTR2_Aniso(ndotwh, wh.x, wh.z, ax, ay) * ndotwh / (4 * hdotwo);
-    float c_pdf = GTR1(ndotwh, lerp(0.1f, 0.001f, this->ClearcoatGloss)) * ndotwh / (4 * hdotwo);
-
-    float3 cd_lin = this->BaseColor;// pow(mat.BaseColor, 2.2);
-    // Luminance approximmation
-    float cd_lum = dot(cd_lin, float3(0.3f, 0.6f, 0.1f));
-
-    // Normalize lum. to isolate hue+sat
-    float3 c_tint = cd_lum > 0 ? (cd_lin / cd_lum) : 1;
-
-    float3 c_spec0 = lerp(this->Specular * 0 * lerp(1, c_tint, this->SpecularTint), cd_lin, this->Metallic);
-
-    float cs_lum = dot(c_spec0, float3(0.3f, 0.6f, 0.1f));
-
-    float cs_w = cs_lum / (cs_lum + (1 - this->Metallic) * cd_lum);
-
-    return c_pdf * this->Clearcoat + (1 - this->Clearcoat) * (cs_w * r_pdf + (1 - cs_w) * d_pdf);
+    return PreparedMaterial(*this).GetPdf(wi, wo);
 }
 
 float3 DisneyMaterial::Evaluate(float3 wi, float3 wo) {
-    float ndotwi = abs(wi.y);
-    float ndotwo = abs(wo.y);
-
-    float3 h = normalize(wi + wo);
-    float ndoth = abs(h.y);
-    float hdotwo = abs(dot(h, wo));
-
-    float3 cd_lin = this->BaseColor;// pow(mat.BaseColor, 2.2);
-    // Luminance approximmation
-    float cd_lum = dot(cd_lin, float3(0.3f, 0.6f, 0.1f));
-
-    // Normalize lum. to isolate hue+sat
-    float3 c_tint = cd_lum > 0 ? (cd_lin / cd_lum) : 1;
-
-    float3 c_spec0 = lerp(this->Specular * 0.1f * lerp(1, c_tint, this->SpecularTint), cd_lin, this->Metallic);
-
-    float3 c_sheen = lerp(1, c_tint, this->SheenTint);
-
-    // Diffuse fresnel - go from 1 at normal incidence to 0.5 at grazing
-    // and lerp in diffuse retro-reflection based on Roughness
-    float f_wo = SchlickFresnelReflectance(ndotwo);
-    float f_wi = SchlickFresnelReflectance(ndotwi);
-
-    float fd90 = 0.5f + 2 * hdotwo * hdotwo * this->Roughness;
-    float fd = lerp(1, fd90, f_wo) * lerp(1, fd90, f_wi);
-
-    // Based on Hanrahan-Krueger brdf approximation of isotropic bssrdf
-    // 1.25 scale is used to (roughly) preserve albedo
-    // fss90 used to "flatten" retroreflection based on Roughness
-    float fss90 = hdotwo * hdotwo * this->Roughness;
-    float fss = lerp(1, fss90, f_wo) * lerp(1, fss90, f_wi);
-    float ss = 1.25f * (fss * (1 / (ndotwo + ndotwi) - 0.5f) + 0.5f);
-
-    // Specular
-    float ax = fmax(0.001f, this->Roughness * this->Roughness * (1 + this->Anisotropy));
-    float ay = fmax(0.001f, this->Roughness * this->Roughness * (1 - this->Anisotropy));
-    float ds = GTR2_Aniso(ndoth, h.x, h.z, ax, ay);
-    float fh = SchlickFresnelReflectance(hdotwo);
-    float3 fs = lerp(c_spec0, 1, fh);
-
-    float gs;
-    gs = SmithGGX_G_Aniso(ndotwo, wo.x, wo.z, ax, ay);
-    gs *= SmithGGX_G_Aniso(ndotwi, wi.x, wi.z, ax, ay);
-
-    // Sheen
-    float3 f_sheen = fh * this->Sheen * c_sheen;
-
-    // Clearcoat (ior = 1.5 -> F0 = 0.04)
-    float dr = GTR1(ndoth, lerp(0.1f, 0.001f, this->ClearcoatGloss));
-    float fr = lerp(0.04f, 1.f, fh);
-    float gr = SmithGGX_G(ndotwo, 0.25) * SmithGGX_G(ndotwi, 0.25);
-
-    float3 ret = (INV_PI * lerp(fd, ss, this->Subsurface) * cd_lin + f_sheen) * (1 - this->Metallic) + gs * fs * ds + this->Clearcoat * gr * fr * dr;
-    if (ret.x > 1 || ret.y > 1 || ret.z > 1) {
-        int q = 1;
-    }
-    return ret;
+    return PreparedMaterial(*this).Evaluate(wi, wo);
 }
 
 float3 DisneyMaterial::Sample(float3 wi, float2 sample, float3& wo, float& pdf) {
-    float ax = fmax(0.001f, this->Roughness * this->Roughness * (1 + this->Anisotropy));
-    float ay = fmax(0.001f, this->Roughness * this->Roughness * (1 - this->Anisotropy));
-
-    float mis_weight = 1;
-    float3 wh;
-
-    if (sample.x < this->Clearcoat) {
-        sample.x /= (this->Clearcoat);
-
-        float a = lerp(0.1f, 0.001f, this->ClearcoatGloss);
-        float ndotwh = sqrt((1 - pow(a * a, 1 - sample.y)) / (1 - a * a));
-        float sintheta = sqrt(1 - ndotwh * ndotwh);
-        wh = normalize(float3(cos(2 * PI * sample.x) * sintheta, ndotwh, sin(2 * PI * sample.x) * sintheta));
-        wo = -wi + 2 * abs(dot(wi, wh)) * wh;
-    } else {
-        sample.x -= (this->Clearcoat);
-        sample.x /= (1 - this->Clearcoat);
-
-        float3 cd_lin = this->BaseColor;// pow(mat.BaseColor, 2.2);
-        // Luminance approximmation
-        float cd_lum = dot(cd_lin, float3(0.3f, 0.6f, 0.1f));
-
-        // Normalize lum. to isolate hue+sat
-        float3 c_tint = cd_lum > 0.f ? (cd_lin / cd_lum) : 1;
-
-        float3 c_spec0 = lerp(this->Specular * 0.3f * lerp(1, c_tint, this->SpecularTint), cd_lin, this->Metallic);
-
-        float cs_lum = dot(c_spec0, float3(0.3f, 0.6f, 0.1f));
-        float cs_w = cs_lum / (cs_lum + (1 - this->Metallic) * cd_lum);
-
-        if (sample.y < cs_w) {
-            sample.y /= cs_w;
-
-            float t = sqrt(sample.y / (1 - sample.y));
-            wh = normalize(float3(t * ax * cos(2 * PI * sample.x), 1, t * ay * sin(2 * PI * sample.x)));
+    return PreparedMaterial(*this).Sample(wi, sample, wo, pdf);
+}
 
-            wo = -wi + 2.f * abs(dot(wi, wh)) * wh;
-        } else {
-            sample.y -= cs_w;
-            sample.y /= (1.f - cs_w);
+PreparedMaterial::PreparedMaterial() : PreparedMaterial(DisneyMaterial()) {}
 
-            wo = Sample_MapToHemisphere(sample, float3(0, 1, 0), 1);
-            wh = normalize(wo + wi);
-        }
-    }
+PreparedMaterial::PreparedMaterial(const DisneyMaterial& material) {
+    params = material;
 
-    //float ndotwh = abs(wh.y);
-    //float hdotwo = abs(dot(wh, *wo));
+    ax = fmax(0.001f, params.Roughness * params.Roughness * (1.f + params.Anisotropy));
+    ay = fmax(0.001f, params.Roughness * params.Roughness * (1.f - params.Anisotropy));
 
-    pdf = GetPdf(wi, wo);
-    return Evaluate(wi, wo);
-}
+    float3 cd_lin = params.BaseColor;// pow(mat.BaseColor, 2.2);
+    // Luminance approximmation
+    cd_lum = dot(cd_lin, float3(0.3f, 0.6f, 0.1f));
 
-float DisneyMaterial::SchlickFresnelReflectance(float u) {
-    float m = clamp(1.f - u, 0.f, 1.f);
-    float m2 = m * m;
-    return m2 * m2 * m;
-}
+    // Normalize lum. to isolate hue+sat
+    float3 c_tint = cd_lum > 0 ? (cd_lin / cd_lum) : 1;
 
-float DisneyMaterial::GTR1(float ndoth, float a) {
-    if (a >= 1.f) return 1.f / PI;
+    c_spec0 = lerp(params.Specular * 0.1f * lerp(1, c_tint, params.SpecularTint), cd_lin, params.Metallic);
+    c_sheen = lerp(1, c_tint, params.SheenTint);
 
-    float a2 = a * a;
-    float t = 1.f + (a2 - 1.f) * ndoth * ndoth;
-    return (a2 - 1.f) / (PI * log(a2) * t);
-}
+    // Lobe selection uses a brighter specular color than Evaluate
+    float3 c_spec0_sample = lerp(params.Specular * 0.3f * lerp(1, c_tint, params.SpecularTint), cd_lin, params.Metallic);
+    float cs_lum = dot(c_spec0_sample, float3(0.3f, 0.6f, 0.1f));
+    cs_w = cs_lum / (cs_lum + (1 - params.Metallic) * cd_lum);
 
-float DisneyMaterial::GTR2(float ndoth, float a) {
-    float a2 = a * a;
-    float t = 1.f + (a2 - 1.f) * ndoth * ndoth;
-    return a2 / (PI * t * t);
-}
+    clearcoat_a = lerp(0.1f, 0.001f, params.ClearcoatGloss);
+    float a2 = clearcoat_a * clearcoat_a;
+    clearcoat_gtr1 = (a2 - 1.f) / (PI * log(a2));
 
-float DisneyMaterial::GTR2_Aniso(float ndoth, float hdotx, float hdoty, float ax, float ay) {
-    float hdotxax2 = powf(hdotx / ax, 2);
-    float hdotyay2 = powf(hdoty / ay, 2);
-    float squares = powf(hdotxax2 + hdotyay2 + ndoth * ndoth, 2);
+    lobes = 0;
+    if (params.Clearcoat != 0.f) lobes |= LOBE_CLEARCOAT;
+    if (params.Sheen != 0.f) lobes |= LOBE_SHEEN;
+    if (params.Metallic != 0.f) lobes |= LOBE_METALLIC;
+    if (ax != ay) lobes |= LOBE_ANISOTROPIC;
+    if (params.Subsurface != 0.f) lobes |= LOBE_SUBSURFACE;
 
-    return 1.f / (PI * ax * ay * squares);
+    const Kernels& k = kernels();
+    evaluate_kernel = k.material_evaluate[lobes];
+    sample_kernel = k.material_sample;
 }
 
-float DisneyMaterial::SmithGGX_G(float ndotv, float a) {
-    float a2 = a * a;
-    float b = ndotv * ndotv;
-    return 1.f / (ndotv + sqrt(a2 + b - a2 * b));
+float PreparedMaterial::GetPdf(float3 wi, float3 wo) const {
+    float pdf;
+    EvaluateWithPdf(wi, wo, pdf);
+    return pdf;
 }
 
-float DisneyMaterial::SmithGGX_G_Aniso(float ndotv, float vdotx, float vdoty, float ax, float ay) {
-    float vdotxax2 = (vdotx * ax) * (vdotx * ax);
-    float vdotyay2 = (vdoty * ay) * (vdoty * ay);
-    return 1.f / (ndotv + sqrt(vdotxax2 + vdotyay2 + ndotv * ndotv));
+float3 PreparedMaterial::Evaluate(float3 wi, float3 wo) const {
+    float pdf;
+    return EvaluateWithPdf(wi, wo, pdf);
 }
 
-float3 DisneyMaterial::Sample_MapToHemisphere(float2 sample, float3 n, float e) {
-    // Construct basis
-    float3 u = GetOrthoVector(n);
-    float3 v = cross(u, n);
-    u = cross(n, v);
-
-    // Calculate 2D sample
-    float r1 = sample.x;
-    float r2 = sample.y;
-
-    // Transform to spherical coordinates
-    float sinpsi = sin(2 * PI * r1);
-    float cospsi = cos(2 * PI * r1);
-    float costheta = pow(1.f - r2, 1.f / (e + 1.f));
-    float sintheta = sqrt(1.f - costheta * costheta);
-
-    return normalize(u * sintheta * cospsi + v * sintheta * sinpsi + n * costheta);
+float3 PreparedMaterial::EvaluateWithPdf(float3 wi, float3 wo, float& pdf) const {
+    return evaluate_kernel(*this, wi, wo, pdf);
 }
 
-float3 DisneyMaterial::GetOrthoVector(float3 n) {
-    float3 p;
-    if (abs(n.z) > 0) {
-        float k = sqrt(n.y * n.y + n.z * n.z);
-        p.x = 0; p.y = -n.z / k; p.z = n.y / k;
-    } else {
-        float k = sqrt(n.x * n.x + n.y * n.y);
-        p.x = n.y / k; p.y = -n.x / k; p.z = 0;
-    }
-    return normalize(p);
+float3 PreparedMaterial::Sample(float3 wi, float2 sample, float3& wo, float& pdf) const {
+    return sample_kernel(*this, wi, sample, wo, pdf);
 }
@@ -0,0 +1,204 @@
+// Scalar Disney BSDF behind PreparedMaterial. Not a standalone file:
+// kernels.inl includes it once per instruction set, inside a namespace, and
+// PreparedMaterial calls the copy for the level selected when it was prepared.
+
+inline float SchlickFresnelReflectance(float u) {
+    float m = clamp(1.f - u, 0.f, 1.f);
+    float m2 = m * m;
+    return m2 * m2 * m;
+}
+
+inline float GTR1(const PreparedMaterial& m, float ndoth) {
+    if (m.clearcoat_a >= 1.f) return 1.f / PI;
+
+    float a2 = m.clearcoat_a * m.clearcoat_a;
+    float t = 1.f + (a2 - 1.f) * ndoth * ndoth;
+    return m.clearcoat_gtr1 / t;
+}
+
+inline float GTR2(float ndoth, float a) {
+    float a2 = a * a;
+    float t = 1.f + (a2 - 1.f) * ndoth * ndoth;
+    return a2 / (PI * t * t);
+}
+
+inline float GTR2_Aniso(const PreparedMaterial& m, float ndoth, float hdotx, float hdoty) {
+    float hdotxax = hdotx / m.ax;
+    float hdotyay = hdoty / m.ay;
+    float squares = hdotxax * hdotxax + hdotyay * hdotyay + ndoth * ndoth;
+
+    return 1.f / (PI * m.ax * m.ay * squares * squares);
+}
+
+inline float SmithGGX_G(float ndotv, float a) {
+    float a2 = a * a;
+    float b = ndotv * ndotv;
+    return 1.f / (ndotv + sqrt(a2 + b - a2 * b));
+}
+
+inline float SmithGGX_G_Aniso(const PreparedMaterial& m, float ndotv, float vdotx, float vdoty) {
+    float vdotxax2 = (vdotx * m.ax) * (vdotx * m.ax);
+    float vdotyay2 = (vdoty * m.ay) * (vdoty * m.ay);
+    return 1.f / (ndotv + sqrt(vdotxax2 + vdotyay2 + ndotv * ndotv));
+}
+
+inline float3 GetOrthoVector(float3 n) {
+    float3 p;
+    if (abs(n.z) > 0) {
+        float k = sqrt(n.y * n.y + n.z * n.z);
+        p.x = 0; p.y = -n.z / k; p.z = n.y / k;
+    } else {
+        float k = sqrt(n.x * n.x + n.y * n.y);
+        p.x = n.y / k; p.y = -n.x / k; p.z = 0;
+    }
+    return normalize(p);
+}
+
+inline float3 Sample_MapToHemisphere(float2 sample, float3 n, float e) {
+    // Construct basis
+    float3 u = GetOrthoVector(n);
+    float3 v = cross(u, n);
+    u = cross(n, v);
+
+    // Calculate 2D sample
+    float r1 = sample.x;
+    float r2 = sample.y;
+
+    // Transform to spherical coordinates
+    float sinpsi, cospsi;
+    fast_sincos(2 * PI * r1, sinpsi, cospsi);
+    float costheta = fast_pow(1.f - r2, 1.f / (e + 1.f));
+    float sintheta = sqrt(1.f - costheta * costheta);
+
+    return normalize(u * sintheta * cospsi + v * sintheta * sinpsi + n * costheta);
+}
+
+// Every lobe missing from Lobes is assumed to have a zero weight, and
+// isotropic materials use the cheaper isotropic GGX terms
+template <uint32_t Lobes>
+float3 MaterialEvaluate(const PreparedMaterial& m, float3 wi, float3 wo, float& pdf) {
+    constexpr bool clearcoat = (Lobes & LOBE_CLEARCOAT) != 0;
+    constexpr bool sheen = (Lobes & LOBE_SHEEN) != 0;
+    constexpr bool metallic = (Lobes & LOBE_METALLIC) != 0;
+    constexpr bool anisotropic = (Lobes & LOBE_ANISOTROPIC) != 0;
+    constexpr bool subsurface = (Lobes & LOBE_SUBSURFACE) != 0;
+
+    float ndotwi = abs(wi.y);
+    float ndotwo = abs(wo.y);
+
+    float3 h = normalize(wi + wo);
+    float ndoth = abs(h.y);
+    float hdotwo = abs(dot(h, wo));
+
+    // Specular distribution is shared with the pdf
+    float ds = anisotropic ? GTR2_Aniso(m, ndoth, h.x, h.z) : GTR2(ndoth, m.ax);
+
+    float d_pdf = ndotwo / PI;
+    float r_pdf = ds * ndoth / (4 * hdotwo);
+    pdf = m.cs_w * r_pdf + (1 - m.cs_w) * d_pdf;
+
+    // Diffuse fresnel - go from 1 at normal incidence to 0.5 at grazing
+    // and lerp in diffuse retro-reflection based on Roughness
+    float f_wo = SchlickFresnelReflectance(ndotwo);
+    float f_wi = SchlickFresnelReflectance(ndotwi);
+
+    float fd90 = 0.5f + 2 * hdotwo * hdotwo * m.params.Roughness;
+    float fd = lerp(1, fd90, f_wo) * lerp(1, fd90, f_wi);
+
+    float3 diffuse;
+    if constexpr (subsurface) {
+        // Based on Hanrahan-Krueger brdf approximation of isotropic bssrdf
+        // 1.25 scale is used to (roughly) preserve albedo
+        // fss90 used to "flatten" retroreflection based on Roughness
+        float fss90 = hdotwo * hdotwo * m.params.Roughness;
+        float fss = lerp(1, fss90, f_wo) * lerp(1, fss90, f_wi);
+        float ss = 1.25f * (fss * (1 / (ndotwo + ndotwi) - 0.5f) + 0.5f);
+
+        diffuse = INV_PI * lerp(fd, ss, m.params.Subsurface) * m.params.BaseColor;
+    } else {
+        diffuse = INV_PI * fd * m.params.BaseColor;
+    }
+
+    // Specular
+    float fh = SchlickFresnelReflectance(hdotwo);
+    float3 fs = lerp(m.c_spec0, 1, fh);
+
+    float gs;
+    if constexpr (anisotropic) {
+        gs = SmithGGX_G_Aniso(m, ndotwo, wo.x, wo.z);
+        gs *= SmithGGX_G_Aniso(m, ndotwi, wi.x, wi.z);
+    } else {
+        gs = SmithGGX_G(ndotwo, m.ax) * SmithGGX_G(ndotwi, m.ax);
+    }
+
+    // Sheen
+    if constexpr (sheen) {
+        diffuse += fh * m.params.Sheen * m.c_sheen;
+    }
+
+    if constexpr (metallic) {
+        diffuse *= (1 - m.params.Metallic);
+    }
+
+    float3 ret = diffuse + gs * fs * ds;
+
+    // Clearcoat (ior = 1.5 -> F0 = 0.04)
+    if constexpr (clearcoat) {
+        float dr = GTR1(m, ndoth);
+        float c_pdf = dr * ndoth / (4 * hdotwo);
+        pdf = c_pdf * m.params.Clearcoat + (1 - m.params.Clearcoat) * pdf;
+
+        float fr = lerp(0.04f, 1.f, fh);
+        float gr = SmithGGX_G(ndotwo, 0.25) * SmithGGX_G(ndotwi, 0.25);
+        ret += m.params.Clearcoat * gr * fr * dr;
+    }
+
+    return ret;
+}
+
+// MaterialEvaluate for every lobe set, indexed by PreparedMaterial::lobes
+template <size_t... Lobes>
+constexpr std::array<MaterialEvaluateFn, sizeof...(Lobes)> MaterialEvaluateTable(std::index_sequence<Lobes...>) {
+    return { { &MaterialEvaluate<Lobes>... } };
+}
+
+constexpr std::array<MaterialEvaluateFn, LOBE_ALL + 1> material_evaluate = MaterialEvaluateTable(std::make_index_sequence<LOBE_ALL + 1>());
+
+float3 MaterialSample(const PreparedMaterial& m, float3 wi, float2 sample, float3& wo, float& pdf) {
+    float3 wh;
+
+    if (sample.x < m.params.Clearcoat) {
+        sample.x /= (m.params.Clearcoat);
+
+        float a = m.clearcoat_a;
+        float ndotwh = sqrt((1 - fast_pow(a * a, 1 - sample.y)) / (1 - a * a));
+        float sintheta = sqrt(1 - ndotwh * ndotwh);
+        float sinphi, cosphi;
+        fast_sincos(2 * PI * sample.x, sinphi, cosphi);
+        wh = normalize(float3(cosphi * sintheta, ndotwh, sinphi * sintheta));
+        wo = -wi + 2 * abs(dot(wi, wh)) * wh;
+    } else {
+        sample.x -= (m.params.Clearcoat);
+        sample.x /= (1 - m.params.Clearcoat);
+
+        if (sample.y < m.cs_w) {
+            sample.y /= m.cs_w;
+
+            float t = sqrt(sample.y / (1 - sample.y));
+            float sinphi, cosphi;
+            fast_sincos(2 * PI * sample.x, sinphi, cosphi);
+            wh = normalize(float3(t * m.ax * cosphi, 1, t * m.ay * sinphi));
+
+            wo = -wi + 2.f * abs(dot(wi, wh)) * wh;
+        } else {
+            sample.y -= m.cs_w;
+            sample.y /= (1.f - m.cs_w);
+
+            wo = Sample_MapToHemisphere(sample, float3(0, 1, 0), 1);
+            wh = normalize(wo + wi);
+        }
+    }
+
+    return material_evaluate[m.lobes](m, wi, wo, pdf);
+}
+
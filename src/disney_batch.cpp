@@ -0,0 +1,28 @@
+#include "disney_batch.h"
+#include "kernels.h"
+
+void DisneyMaterialBatch::set(int lane, const DisneyMaterial& material) {
+    BaseColor.set(lane, material.BaseColor);
+    Metallic[lane] = material.Metallic;
+    Specular[lane] = material.Specular;
+    Anisotropy[lane] = material.Anisotropy;
+    Roughness[lane] = material.Roughness;
+    SpecularTint[lane] = material.SpecularTint;
+    SheenTint[lane] = material.SheenTint;
+    Sheen[lane] = material.Sheen;
+    ClearcoatGloss[lane] = material.ClearcoatGloss;
+    Clearcoat[lane] = material.Clearcoat;
+    Subsurface[lane] = material.Subsurface;
+}
+
+void DisneyMaterialBatch::GetPdf(const Float3Batch& wi, const Float3Batch& wo, float* pdf) const {
+    kernels().bsdf_get_pdf(*this, wi, wo, pdf);
+}
+
+void DisneyMaterialBatch::Evaluate(const Float3Batch& wi, const Float3Batch& wo, Float3Batch& result) const {
+    kernels().bsdf_evaluate(*this, wi, wo, result);
+}
+
+void DisneyMaterialBatch::Sample(const Float3Batch& wi, const float* sample_x, const float* sample_y, Float3Batch& wo, float* pdf, Float3Batch& result) const {
+    kernels().bsdf_sample(*this, wi, sample_x, sample_y, wo, pdf, result);
+}
@@ -0,0 +1,242 @@
+// Batched Disney BSDF kernels. Not a standalone file: kernels.inl includes it
+// once per instruction set, inside a namespace and with LANES defined.
+//
+// The kernels are written once against the wide vector types from math.hpp
+// and mirror the scalar code in disney.inl line by line. vfloat is LANES wide,
+// a batch is processed in DISNEY_BATCH_SIZE / LANES chunks.
+typedef floatx<LANES> vfloat;
+typedef maskx<LANES> vmask;
+typedef float3x<LANES> vfloat3;
+
+inline vfloat3 LoadFloat3(const Float3Batch& b, int offset) {
+    return vfloat3::load(b.x + offset, b.y + offset, b.z + offset);
+}
+
+inline void StoreFloat3(const vfloat3& v, Float3Batch& b, int offset) {
+    v.store(b.x + offset, b.y + offset, b.z + offset);
+}
+
+struct Material {
+    vfloat3 BaseColor;
+    vfloat Metallic;
+    vfloat Specular;
+    vfloat Anisotropy;
+    vfloat Roughness;
+    vfloat SpecularTint;
+    vfloat SheenTint;
+    vfloat Sheen;
+    vfloat ClearcoatGloss;
+    vfloat Clearcoat;
+    vfloat Subsurface;
+};
+
+inline Material LoadMaterial(const DisneyMaterialBatch& b, int offset) {
+    Material m;
+    m.BaseColor = LoadFloat3(b.BaseColor, offset);
+    m.Metallic = vfloat::load(b.Metallic + offset);
+    m.Specular = vfloat::load(b.Specular + offset);
+    m.Anisotropy = vfloat::load(b.Anisotropy + offset);
+    m.Roughness = vfloat::load(b.Roughness + offset);
+    m.SpecularTint = vfloat::load(b.SpecularTint + offset);
+    m.SheenTint = vfloat::load(b.SheenTint + offset);
+    m.Sheen = vfloat::load(b.Sheen + offset);
+    m.ClearcoatGloss = vfloat::load(b.ClearcoatGloss + offset);
+    m.Clearcoat = vfloat::load(b.Clearcoat + offset);
+    m.Subsurface = vfloat::load(b.Subsurface + offset);
+    return m;
+}
+
+inline vfloat SchlickFresnelReflectance(vfloat u) {
+    vfloat m = clamp(1.f - u, 0.f, 1.f);
+    vfloat m2 = m * m;
+    return m2 * m2 * m;
+}
+
+// a is always below 1 for clearcoat, so the a >= 1 case of the scalar version never applies
+inline vfloat GTR1(vfloat ndoth, vfloat a) {
+    vfloat a2 = a * a;
+    vfloat t = 1.f + (a2 - 1.f) * ndoth * ndoth;
+    vfloat log_a2 = fast_log2(a2) * 0.69314718f;
+    return (a2 - 1.f) / (PI * log_a2 * t);
+}
+
+inline vfloat GTR2_Aniso(vfloat ndoth, vfloat hdotx, vfloat hdoty, vfloat ax, vfloat ay) {
+    vfloat hx = hdotx / ax;
+    vfloat hy = hdoty / ay;
+    vfloat s = hx * hx + hy * hy + ndoth * ndoth;
+    return 1.f / (PI * ax * ay * s * s);
+}
+
+inline vfloat SmithGGX_G(vfloat ndotv, vfloat a) {
+    vfloat a2 = a * a;
+    vfloat b = ndotv * ndotv;
+    return 1.f / (ndotv + sqrt(a2 + b - a2 * b));
+}
+
+inline vfloat SmithGGX_G_Aniso(vfloat ndotv, vfloat vdotx, vfloat vdoty, vfloat ax, vfloat ay) {
+    vfloat x = vdotx * ax;
+    vfloat y = vdoty * ay;
+    return 1.f / (ndotv + sqrt(x * x + y * y + ndotv * ndotv));
+}
+
+inline vfloat Luminance(const vfloat3& c) {
+    return c.x * 0.3f + c.y * 0.6f + c.z * 0.1f;
+}
+
+// Normalize lum. to isolate hue+sat
+inline vfloat3 GetTint(const vfloat3& cd_lin, vfloat cd_lum) {
+    vmask positive = cd_lum > 0.f;
+    return select(positive, cd_lin / cd_lum, vfloat3(1.f));
+}
+
+inline vfloat GetSpecularWeight(const Material& m) {
+    vfloat cd_lum = Luminance(m.BaseColor);
+    vfloat3 c_tint = GetTint(m.BaseColor, cd_lum);
+    vfloat3 c_spec0 = lerp(lerp(vfloat3(1.f), c_tint, m.SpecularTint) * vfloat3(m.Specular * 0.3f), m.BaseColor, m.Metallic);
+    vfloat cs_lum = Luminance(c_spec0);
+    return cs_lum / (cs_lum + (1.f - m.Metallic) * cd_lum);
+}
+
+vfloat GetPdf(const Material& m, const vfloat3& wi, const vfloat3& wo) {
+    vfloat r2 = m.Roughness * m.Roughness;
+    vfloat ax = max(0.001f, r2 * (1.f + m.Anisotropy));
+    vfloat ay = max(0.001f, r2 * (1.f - m.Anisotropy));
+    vfloat3 wh = normalize(wo + wi);
+    vfloat ndotwh = abs(wh.y);
+    vfloat hdotwo = abs(dot(wh, wo));
+
+    vfloat d_pdf = abs(wo.y) * INV_PI;
+    vfloat r_pdf = GTR2_Aniso(ndotwh, wh.x, wh.z, ax, ay) * ndotwh / (4.f * hdotwo);
+
+    vfloat cs_w = GetSpecularWeight(m);
+    vfloat pdf = cs_w * r_pdf + (1.f - cs_w) * d_pdf;
+
+    // Clearcoat is off for most materials, skip the log when no lane uses it
+    if (any(m.Clearcoat > 0.f)) {
+        vfloat c_pdf = GTR1(ndotwh, lerp(0.1f, 0.001f, m.ClearcoatGloss)) * ndotwh / (4.f * hdotwo);
+        pdf = c_pdf * m.Clearcoat + (1.f - m.Clearcoat) * pdf;
+    }
+
+    return pdf;
+}
+
+vfloat3 Evaluate(const Material& m, const vfloat3& wi, const vfloat3& wo) {
+    vfloat ndotwi = abs(wi.y);
+    vfloat ndotwo = abs(wo.y);
+
+    vfloat3 h = normalize(wi + wo);
+    vfloat ndoth = abs(h.y);
+    vfloat hdotwo = abs(dot(h, wo));
+
+    vfloat3 cd_lin = m.BaseColor;
+    vfloat cd_lum = Luminance(cd_lin);
+    vfloat3 c_tint = GetTint(cd_lin, cd_lum);
+
+    vfloat3 c_spec0 = lerp(lerp(vfloat3(1.f), c_tint, m.SpecularTint) * vfloat3(m.Specular * 0.1f), cd_lin, m.Metallic);
+    vfloat3 c_sheen = lerp(vfloat3(1.f), c_tint, m.SheenTint);
+
+    // Diffuse fresnel - go from 1 at normal incidence to 0.5 at grazing
+    // and lerp in diffuse retro-reflection based on Roughness
+    vfloat f_wo = SchlickFresnelReflectance(ndotwo);
+    vfloat f_wi = SchlickFresnelReflectance(ndotwi);
+
+    vfloat h2r = hdotwo * hdotwo * m.Roughness;
+    vfloat fd90 = 0.5f + 2.f * h2r;
+    vfloat fd = lerp(1.f, fd90, f_wo) * lerp(1.f, fd90, f_wi);
+
+    // Hanrahan-Krueger subsurface approximation
+    vfloat fss = lerp(1.f, h2r, f_wo) * lerp(1.f, h2r, f_wi);
+    vfloat ss = 1.25f * (fss * (1.f / (ndotwo + ndotwi) - 0.5f) + 0.5f);
+
+    // Specular
+    vfloat r2 = m.Roughness * m.Roughness;
+    vfloat ax = max(0.001f, r2 * (1.f + m.Anisotropy));
+    vfloat ay = max(0.001f, r2 * (1.f - m.Anisotropy));
+    vfloat ds = GTR2_Aniso(ndoth, h.x, h.z, ax, ay);
+    vfloat fh = SchlickFresnelReflectance(hdotwo);
+    vfloat3 fs = lerp(c_spec0, vfloat3(1.f), fh);
+
+    vfloat gs = SmithGGX_G_Aniso(ndotwo, wo.x, wo.z, ax, ay) * SmithGGX_G_Aniso(ndotwi, wi.x, wi.z, ax, ay);
+
+    // Sheen
+    vfloat3 f_sheen = c_sheen * vfloat3(fh * m.Sheen);
+
+    vfloat diffuse = INV_PI * lerp(fd, ss, m.Subsurface);
+    vfloat3 ret = (cd_lin * vfloat3(diffuse) + f_sheen) * vfloat3(1.f - m.Metallic) + fs * vfloat3(gs * ds);
+
+    // Clearcoat (ior = 1.5 -> F0 = 0.04)
+    if (any(m.Clearcoat > 0.f)) {
+        vfloat dr = GTR1(ndoth, lerp(0.1f, 0.001f, m.ClearcoatGloss));
+        vfloat fr = lerp(0.04f, 1.f, fh);
+        vfloat gr = SmithGGX_G(ndotwo, 0.25f) * SmithGGX_G(ndotwi, 0.25f);
+        ret = ret + vfloat3(m.Clearcoat * gr * fr * dr);
+    }
+
+    return ret;
+}
+
+vfloat3 Sample(const Material& m, const vfloat3& wi, vfloat sample_x, vfloat sample_y) {
+    vfloat r2 = m.Roughness * m.Roughness;
+    vfloat ax = max(0.001f, r2 * (1.f + m.Anisotropy));
+    vfloat ay = max(0.001f, r2 * (1.f - m.Anisotropy));
+
+    // Pick a lobe per lane and remap the sample into it
+    vmask clearcoat = sample_x < m.Clearcoat;
+    vfloat u = select(clearcoat, sample_x / m.Clearcoat, (sample_x - m.Clearcoat) / (1.f - m.Clearcoat));
+
+    vfloat cs_w = GetSpecularWeight(m);
+    vmask specular = sample_y < cs_w;
+
+    vfloat s, c;
+    fast_sincos(2.f * PI * u, s, c);
+
+    // Specular lobe
+    vfloat v = sample_y / cs_w;
+    vfloat t = sqrt(v / (1.f - v));
+    vfloat3 wh = normalize(vfloat3(t * ax * c, 1.f, t * ay * s));
+
+    // Clearcoat lobe
+    if (any(clearcoat)) {
+        vfloat a = lerp(0.1f, 0.001f, m.ClearcoatGloss);
+        vfloat a2 = a * a;
+        vfloat ndotwh = sqrt((1.f - fast_pow(a2, 1.f - sample_y)) / (1.f - a2));
+        vfloat sintheta = sqrt(1.f - ndotwh * ndotwh);
+        wh = select(clearcoat, normalize(vfloat3(c * sintheta, ndotwh, s * sintheta)), wh);
+    }
+
+    vfloat3 reflected = vfloat3(2.f * abs(dot(wi, wh))) * wh - wi;
+
+    // Cosine weighted diffuse lobe
+    vfloat d = (sample_y - cs_w) / (1.f - cs_w);
+    vfloat costheta = sqrt(1.f - d);
+    vfloat sintheta = sqrt(1.f - costheta * costheta);
+    vfloat3 diffuse = normalize(vfloat3(sintheta * c, costheta, sintheta * s));
+
+    return select(clearcoat | specular, reflected, diffuse);
+}
+
+void BatchGetPdf(const DisneyMaterialBatch& b, const Float3Batch& wi, const Float3Batch& wo, float* pdf) {
+    for (int i = 0; i < DISNEY_BATCH_SIZE; i += LANES) {
+        Material m = LoadMaterial(b, i);
+        GetPdf(m, LoadFloat3(wi, i), LoadFloat3(wo, i)).store(pdf + i);
+    }
+}
+
+void BatchEvaluate(const DisneyMaterialBatch& b, const Float3Batch& wi, const Float3Batch& wo, Float3Batch& result) {
+    for (int i = 0; i < DISNEY_BATCH_SIZE; i += LANES) {
+        Material m = LoadMaterial(b, i);
+        StoreFloat3(Evaluate(m, LoadFloat3(wi, i), LoadFloat3(wo, i)), result, i);
+    }
+}
+
+void BatchSample(const DisneyMaterialBatch& b, const Float3Batch& wi, const float* sample_x, const float* sample_y, Float3Batch& wo, float* pdf, Float3Batch& result) {
+    for (int i = 0; i < DISNEY_BATCH_SIZE; i += LANES) {
+        Material m = LoadMaterial(b, i);
+        vfloat3 wi_i = LoadFloat3(wi, i);
+        vfloat3 wo_i = Sample(m, wi_i, vfloat::load(sample_x + i), vfloat::load(sample_y + i));
+
+        StoreFloat3(wo_i, wo, i);
+        GetPdf(m, wi_i, wo_i).store(pdf + i);
+        StoreFloat3(Evaluate(m, wi_i, wo_i), result, i);
+    }
+}
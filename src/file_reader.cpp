@@ -0,0 +1,251 @@
+#include "file_reader.h"
+
+#include <atomic>
+#include <cstdio>
+
+#ifdef MIR_HAVE_LIBURING
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <liburing.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static bool ReadWholeFile(const std::string& path, std::vector<uint8_t>& data) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) return false;
+
+    bool read = fseek(file, 0, SEEK_END) == 0;
+    long size = read ? ftell(file) : -1;
+    read = size >= 0 && fseek(file, 0, SEEK_SET) == 0;
+    if (read) {
+        data.resize((size_t)size);
+        read = fread(data.data(), 1, data.size(), file) == data.size();
+    }
+
+    fclose(file);
+    return read;
+}
+
+static bool ReadFilesBlocking(const std::vector<std::string>& files, ThreadPool& pool, const FileConsumer& consume) {
+    std::atomic<bool> failed(false);
+    pool.parallel_for(files.size(), [&](size_t i) {
+        std::vector<uint8_t> data;
+        if (!ReadWholeFile(files[i], data)) {
+            failed = true;
+            return;
+        }
+        consume(i, data.data(), data.size());
+    });
+    return !failed;
+}
+
+#ifdef MIR_HAVE_LIBURING
+// One file on its way through the ring, fd is -1 until the open completes
+struct PendingRead {
+    size_t index;
+    int fd;
+    std::vector<uint8_t> data;
+    size_t done;
+};
+
+static bool UringSupported(io_uring& ring) {
+    io_uring_probe* probe = io_uring_get_probe_ring(&ring);
+    if (probe == nullptr) return false;
+
+    bool supported = io_uring_opcode_supported(probe, IORING_OP_OPENAT) && io_uring_opcode_supported(probe, IORING_OP_READ);
+    io_uring_free_probe(probe);
+    return supported;
+}
+
+// Waits for the next completion, a signal interrupting the wait is retried
+static bool WaitCompletion(io_uring& ring, io_uring_cqe*& cqe) {
+    int result;
+    do {
+        result = io_uring_wait_cqe(&ring, &cqe);
+    } while (result == -EINTR);
+    return result == 0;
+}
+
+// Cancels the requests still in the ring after it failed and waits for them
+// to come back, closing their files and adding their indices to unread.
+// Requests the kernel does not give back within a second are not freed, it may
+// still write into their buffers, but their files are closed and read again.
+static void CancelRequests(io_uring& ring, std::unordered_set<PendingRead*>& in_ring, const std::function<void(PendingRead*)>& release, std::vector<size_t>& unread) {
+    for (PendingRead* request : in_ring) {
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        if (sqe == nullptr) break;
+        // What io_uring_prep_cancel does, whose argument type changed
+        // between liburing versions
+        io_uring_prep_rw(IORING_OP_ASYNC_CANCEL, sqe, -1, request, 0, 0);
+        io_uring_sqe_set_data(sqe, nullptr);
+    }
+    io_uring_submit(&ring);
+
+    __kernel_timespec timeout = { 1, 0 };
+    while (!in_ring.empty()) {
+        io_uring_cqe* cqe;
+        int result = io_uring_wait_cqe_timeout(&ring, &cqe, &timeout);
+        if (result == -EINTR) continue;
+        if (result < 0) break;
+
+        PendingRead* request = (PendingRead*)io_uring_cqe_get_data(cqe);
+        result = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        // Completions of the cancels themselves carry no request
+        if (request == nullptr) continue;
+
+        in_ring.erase(request);
+        // An open can finish before its cancel arrives
+        if (request->fd < 0 && result >= 0) close(result);
+        if (request->fd >= 0) close(request->fd);
+        unread.push_back(request->index);
+        release(request);
+    }
+
+    for (PendingRead* request : in_ring) {
+        if (request->fd >= 0) close(request->fd);
+        unread.push_back(request->index);
+    }
+}
+
+// The calling thread drives the ring and workers consume completed files.
+// Every file counts against max_in_flight from the moment its open is
+// submitted until its consumer returns, which bounds the memory held in
+// buffers no matter how fast the storage is. If the ring itself fails, the
+// requests in it are cancelled and the files not yet handed to a worker are
+// read with the blocking reader instead.
+static bool ReadFilesUring(const std::vector<std::string>& files, ThreadPool& pool, size_t max_in_flight, const FileConsumer& consume, bool& supported) {
+    io_uring ring;
+    supported = io_uring_queue_init((unsigned)max_in_flight, &ring, 0) == 0;
+    if (!supported) return false;
+    if (!UringSupported(ring)) {
+        io_uring_queue_exit(&ring);
+        supported = false;
+        return false;
+    }
+
+    std::mutex mutex;
+    std::condition_variable released;
+    size_t outstanding = 0;
+    size_t next = 0;
+    std::unordered_set<PendingRead*> in_ring;
+    bool failed = false;
+    bool ring_failed = false;
+
+    auto release = [&](PendingRead* request) {
+        delete request;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            outstanding--;
+        }
+        released.notify_one();
+    };
+
+    while (next < files.size() || !in_ring.empty()) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (in_ring.empty()) {
+                released.wait(lock, [&] { return outstanding < max_in_flight; });
+            }
+
+            while (next < files.size() && outstanding < max_in_flight) {
+                io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+                if (sqe == nullptr) break;
+
+                PendingRead* request = new PendingRead{ next, -1, {}, 0 };
+                io_uring_prep_openat(sqe, AT_FDCWD, files[next].c_str(), O_RDONLY | O_CLOEXEC, 0);
+                io_uring_sqe_set_data(sqe, request);
+                next++;
+                outstanding++;
+                in_ring.insert(request);
+            }
+        }
+
+        io_uring_submit(&ring);
+
+        io_uring_cqe* cqe;
+        if (!WaitCompletion(ring, cqe)) {
+            ring_failed = true;
+            break;
+        }
+        PendingRead* request = (PendingRead*)io_uring_cqe_get_data(cqe);
+        int result = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        in_ring.erase(request);
+
+        bool ok = result >= 0;
+        if (ok && request->fd < 0) {
+            request->fd = result;
+            struct stat info;
+            ok = fstat(request->fd, &info) == 0;
+            if (ok) request->data.resize((size_t)info.st_size);
+        } else if (ok) {
+            // A zero length read before the end means the file shrank
+            ok = result > 0;
+            request->done += (size_t)result;
+        }
+
+        if (!ok) {
+            if (request->fd >= 0) close(request->fd);
+            release(request);
+            failed = true;
+            next = files.size();
+            continue;
+        }
+
+        // Reads may come back short on network filesystems, ask for the rest
+        if (request->done < request->data.size()) {
+            io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_read(sqe, request->fd, request->data.data() + request->done, (unsigned)(request->data.size() - request->done), request->done);
+            io_uring_sqe_set_data(sqe, request);
+            in_ring.insert(request);
+            continue;
+        }
+
+        close(request->fd);
+        pool.enqueue([&consume, &release, request] {
+            consume(request->index, request->data.data(), request->data.size());
+            release(request);
+        });
+    }
+
+    std::vector<size_t> unread;
+    if (ring_failed) {
+        CancelRequests(ring, in_ring, release, unread);
+        for (; next < files.size(); next++) {
+            unread.push_back(next);
+        }
+    }
+
+    pool.wait();
+    io_uring_queue_exit(&ring);
+
+    // A file that could not be read has already failed the whole read
+    if (!failed && !unread.empty()) {
+        std::vector<std::string> rest;
+        for (size_t i : unread) {
+            rest.push_back(files[i]);
+        }
+        failed = !ReadFilesBlocking(rest, pool, [&](size_t i, const uint8_t* data, size_t size) {
+            consume(unread[i], data, size);
+        });
+    }
+    return !failed;
+}
+#endif
+
+bool ReadFiles(const std::vector<std::string>& files, ThreadPool& pool, size_t max_in_flight, const FileConsumer& consume) {
+#ifdef MIR_HAVE_LIBURING
+    bool supported = false;
+    bool read = ReadFilesUring(files, pool, max_in_flight > 0 ? max_in_flight : 1, consume, supported);
+    if (supported) return read;
+#else
+    (void)max_in_flight;
+#endif
+    return ReadFilesBlocking(files, pool, consume);
+}
@@ -0,0 +1,365 @@
+#include "integrator.h"
+#include "kernels.h"
+
+#include <cmath>
+
+struct ScatterEvent {
+    bool valid;
+    float distance;
+    uint16_t sample;
+    float3 position;
+    float3 gradient;
+    float3 tangent;
+    const PreparedMaterial* mat;
+};
+
+static ScatterEvent SampleVolume(const Ray& ray, Rng& rng, const SceneContext& scene) {
+    const Volume& v = scene.volume;
+    const PLF& plf = scene.plf;
+
+    ScatterEvent result = { 0 };
+    result.valid = false;
+    result.distance = 0.f;
+
+    /* Ray Marching */
+    uint16_t sample;
+    if (kernels().march(v, plf, ray.origin, ray.direction, result.distance, sample)) { // TODO: handle volumetric scattering
+        float3 current_point = ray.origin + ray.direction * result.distance;
+        result.valid = true;
+        result.position = current_point;
+        result.sample = sample;
+        result.mat = &plf.get_prepared_for(sample);
+        result.gradient = v.gradient_at(current_point);
+        result.tangent = normalize(float3(result.gradient.z, result.gradient.z, -result.gradient.x - result.gradient.y));
+    }
+
+    /* Delta tracking for volumetric scattering */
+    /*
+    while (result.distance < 1.f) {
+        result.distance -= logf(1.f - rng.generate()) / (MAX_DENSITY * DENSITY_MULTIPLIER);
+
+        float3 current_point = ray.origin + ray.direction * result.distance;
+        uint32_t sample = v.sample_at(current_point);
+        DisneyMaterial mat = plf.get_material_for(sample);
+
+        float density = 1.f - mat.Transmission;
+        if ((density / MAX_DENSITY) > rng.generate()) {
+            result.valid = true;
+            result.position = current_point;
+            result.sample = sample;
+            result.mat = mat;
+            result.gradient = v.gradient_at(current_point);
+            result.tangent = normalize(float3(result.gradient.z, result.gradient.z, -result.gradient.x - result.gradient.y));
+            
+            break;
+        }
+    }
+    */
+
+    return result;
+}
+
+// Just one spherical light for now
+// TODO: Figure out why light position is flipped over the x-z plane
+SphereLight SceneLight() {
+    return SphereLight(float3(0.0, -1.0, 0.0), LIGHT_RADIUS, float3(LIGHT_INTENSITY));
+}
+
+// Power heuristic with beta = 2
+static float PowerHeuristic(float pdf, float other_pdf) {
+    float a = pdf * pdf;
+    float b = other_pdf * other_pdf;
+    return a + b > 0.f ? a / (a + b) : 0.f;
+}
+
+// Starts a ray leaving the surface point p. The march would find the voxel p
+// lies in straight away and the surface would shadow itself, so the ray
+// starts RAY_OFFSET_VOXELS voxels out along direction. Returns the distance
+// skipped.
+static float LeaveSurface(float3 p, float3 direction, const SceneContext& scene, Ray& ray) {
+    float3 voxel = scene.volume.voxel_size();
+    float offset = RAY_OFFSET_VOXELS * fmax(voxel.x, fmax(voxel.y, voxel.z));
+    ray.origin = p + direction * offset;
+    ray.direction = direction;
+    return offset;
+}
+
+bool LightVisible(float3 p, float3 wo, float light_distance, Rng& rng, const SceneContext& scene) {
+    Ray light_ray;
+    float offset = LeaveSurface(p, wo, scene, light_ray);
+    ScatterEvent light_hit = SampleVolume(light_ray, rng, scene);
+    return !light_hit.valid || offset + light_hit.distance >= light_distance;
+}
+
+static float3 SampleLights(float3 wi_t, float3 p, float3 n, const PreparedMaterial& material, Rng& rng, const SceneContext& scene) {
+    float3 radiance = 0.f;
+
+    // Tangent space basis vectors
+    float3 normal = n;
+    float3 tangent = normalize(float3(normal.z, normal.z, -normal.x - normal.y));
+    float3 bitangent = cross(tangent, normal);
+
+    // Sample every light in the scene, combining light and BSDF sampling with MIS
+    for (size_t i = 0; i < 1; i++) {
+        const SphereLight& light = scene.light;
+
+        // Light sampling
+        float3 wo;
+        float light_distance;
+        float light_pdf = light.Sample(p, float2(rng.generate(), rng.generate()), wo, light_distance);
+        if (light_pdf > 0.f && LightVisible(p, wo, light_distance, rng, scene)) {
+            // Convert outgoing angle to tangent space
+            float3 wo_t = float3(tangent.x * wo.x + tangent.y * wo.y + tangent.z * wo.z,
+                normal.x * wo.x + normal.y * wo.y + normal.z * wo.z,
+                bitangent.x * wo.x + bitangent.y * wo.y + bitangent.z * wo.z);
+
+            // Multiply light contribution by light emissive color
+            float bsdf_pdf;
+            float3 brdf = material.EvaluateWithPdf(wi_t, wo_t, bsdf_pdf);
+            float weight = PowerHeuristic(light_pdf, bsdf_pdf);
+            radiance += brdf * light.emission * (weight / light_pdf);
+        }
+
+        // BSDF sampling, only contributes if the sampled direction hits the light
+        float3 wo_t;
+        float bsdf_pdf;
+        float3 brdf = material.Sample(wi_t, float2(rng.generate(), rng.generate()), wo_t, bsdf_pdf);
+        if (bsdf_pdf > 0.f) {
+            Ray ray;
+            ray.origin = p;
+            ray.direction = normalize(float3(tangent.x * wo_t.x + normal.x * wo_t.y + bitangent.x * wo_t.z,
+                                             tangent.y * wo_t.x + normal.y * wo_t.y + bitangent.y * wo_t.z,
+                                             tangent.z * wo_t.x + normal.z * wo_t.y + bitangent.z * wo_t.z));
+
+            light_distance = light.Intersect(ray);
+            if (light_distance >= 0.f && LightVisible(p, ray.direction, light_distance, rng, scene)) {
+                float weight = PowerHeuristic(bsdf_pdf, light.GetPdf(p, ray.direction));
+                radiance += brdf * light.emission * (weight / bsdf_pdf);
+            }
+        }
+    }
+
+    return radiance;
+}
+
+// Samples a continuation direction from the material BSDF. Returns the world
+// space direction and sets weight to the BSDF value divided by its pdf.
+static float3 SampleBsdf(const PreparedMaterial& material, float3 wi_t, float3 tangent, float3 normal, float3 bitangent, Rng& rng, float3& weight) {
+    float3 wo_t;
+    float pdf;
+    float3 brdf = material.Sample(wi_t, float2(rng.generate(), rng.generate()), wo_t, pdf);
+    weight = brdf / pdf;
+
+    // Convert output direction back to world coords
+    float3 wo = float3(tangent.x * wo_t.x + normal.x * wo_t.y + bitangent.x * wo_t.z,
+                       tangent.y * wo_t.x + normal.y * wo_t.y + bitangent.y * wo_t.z,
+                       tangent.z * wo_t.x + normal.z * wo_t.y + bitangent.z * wo_t.z);
+    return normalize(wo);
+}
+
+// Follows a path onwards from a scatter event that has already been found at
+// the given depth. Emissive and UseCache compile out the emission test and the
+// radiance cache when the transfer function or settings don't need them.
+template <bool Emissive, bool UseCache>
+float3 trace_path(Ray ray, ScatterEvent hit, int depth, Rng& rng, const SceneContext& scene) {
+    float3 color;
+    float3 throughput = float3(1.f);
+
+    // Path vertices, kept so their outgoing radiance can be written back to the cache
+    struct PathVertex {
+        float3 position;
+        float3 normal;
+        float3 color;
+        float3 throughput;
+    };
+    PathVertex vertices[UseCache ? MAX_BOUNCES : 1];
+    int num_vertices = 0;
+
+    for (int i = depth; i < MAX_BOUNCES; i++) {
+        if (i > depth) {
+            hit = SampleVolume(ray, rng, scene);
+
+            // The ray missed
+            if (!hit.valid) {
+                color += throughput * float3(0.f); // add background color
+                break;
+            }
+        }
+
+        // From the second bounce onward, end the path early if the cache already
+        // knows how much light leaves this point
+        if constexpr (UseCache) {
+            float3 cached;
+            if (i > 0 && scene.cache->lookup(hit.position, hit.gradient, cached)) {
+                color += throughput * cached;
+                break;
+            }
+
+            vertices[num_vertices++] = { hit.position, hit.gradient, color, throughput };
+        }
+
+        const PreparedMaterial& material = *hit.mat;
+        
+        // Check if material is emissive
+        if constexpr (Emissive) {
+            if (material.params.Emission.r > 0 || material.params.Emission.g > 0 || material.params.Emission.b > 0) {
+                color += throughput * material.params.Emission;
+            }
+        }
+
+        // Tangent space basis vectors
+        float3 normal = hit.gradient;
+        float3 tangent = hit.tangent;
+        float3 bitangent = cross(tangent, normal);
+
+        float3 wi = -ray.direction;
+        float3 wi_t = float3(tangent.x * wi.x + tangent.y * wi.y + tangent.z * wi.z, // Convert normal to tangent space
+                             normal.x * wi.x + normal.y * wi.y + normal.z * wi.z,
+                             bitangent.x * wi.x + bitangent.y * wi.y + bitangent.z * wi.z);
+
+        // Calculate direct lighting. The primary hit took the longest march to
+        // find, so it gets LIGHT_SPLIT shadow rays instead of one.
+        int light_samples = i == 0 ? LIGHT_SPLIT : 1;
+        float3 radiance = 0.f;
+        for (int j = 0; j < light_samples; j++) {
+            radiance += SampleLights(wi_t, hit.position, hit.gradient, material, rng, scene);
+        }
+        color += throughput * radiance / (float)light_samples;
+
+        // Likewise branch the primary hit into BSDF_SPLIT independent paths, each
+        // carrying an equal share of the throughput
+        if (i == 0 && BSDF_SPLIT > 1) {
+            for (int j = 0; j < BSDF_SPLIT && i + 1 < MAX_BOUNCES; j++) {
+                float3 weight;
+                Ray branch;
+                LeaveSurface(hit.position, SampleBsdf(material, wi_t, tangent, normal, bitangent, rng, weight), scene, branch);
+
+                ScatterEvent branch_hit = SampleVolume(branch, rng, scene);
+                if (!branch_hit.valid) {
+                    continue; // background is black
+                }
+
+                color += throughput * weight / (float)BSDF_SPLIT * trace_path<Emissive, UseCache>(branch, branch_hit, i + 1, rng, scene);
+            }
+            break;
+        }
+
+        // Russian roulette. Survival follows the energy the path would still
+        // carry after scattering off this material, and survivors are reweighted
+        // so the estimate stays unbiased.
+        if (i + 1 >= RR_MIN_DEPTH && i + 1 < MAX_BOUNCES) {
+            float3 albedo = max(material.params.BaseColor, float3(material.params.Specular));
+            float3 expected = throughput * albedo;
+            float survival = fmin(RR_MAX_SURVIVAL, fmax(expected.x, fmax(expected.y, expected.z)));
+            if (survival <= 0.f || rng.generate() >= survival) {
+                break;
+            }
+            throughput /= survival;
+        }
+
+        // Sample the material BSDF and accumulate its weight
+        float3 weight;
+        float3 wo = SampleBsdf(material, wi_t, tangent, normal, bitangent, rng, weight);
+        throughput *= weight;
+
+        // Find the next bounce direction
+        LeaveSurface(hit.position, wo, scene, ray);
+    }
+
+    // Everything gathered after a vertex, divided by the throughput that reached
+    // it, is the radiance leaving that vertex along the path
+    for (int i = 0; i < num_vertices; i++) {
+        float3 radiance = color - vertices[i].color;
+        float3 t = vertices[i].throughput;
+        radiance = float3(t.x > 0 ? radiance.x / t.x : 0, t.y > 0 ? radiance.y / t.y : 0, t.z > 0 ? radiance.z / t.z : 0);
+
+        scene.cache->insert(vertices[i].position, vertices[i].normal, radiance);
+    }
+
+    return color;
+}
+
+// Shades only the first hit with direct lighting. This is the whole path when
+// there is a single bounce, without the path loop around it.
+template <bool Emissive>
+float3 shade_direct(Ray ray, ScatterEvent hit, Rng& rng, const SceneContext& scene) {
+    const PreparedMaterial& material = *hit.mat;
+
+    float3 color = 0.f;
+    if constexpr (Emissive) {
+        color += material.params.Emission;
+    }
+
+    // Convert incoming direction to tangent space
+    float3 normal = hit.gradient;
+    float3 tangent = hit.tangent;
+    float3 bitangent = cross(tangent, normal);
+    float3 wi = -ray.direction;
+    float3 wi_t = float3(dot(tangent, wi), dot(normal, wi), dot(bitangent, wi));
+
+    float3 radiance = 0.f;
+    for (int j = 0; j < LIGHT_SPLIT; j++) {
+        radiance += SampleLights(wi_t, hit.position, hit.gradient, material, rng, scene);
+    }
+    return color + radiance / (float)LIGHT_SPLIT;
+}
+
+template <bool MultiBounce, bool Emissive, bool UseCache>
+float3 trace_ray(Ray ray, Rng& rng, const SceneContext& scene) {
+    ScatterEvent hit = SampleVolume(ray, rng, scene);
+
+    // Camera rays can see the light directly. Light hit by later bounces is
+    // already accounted for by the BSDF sampling half of SampleLights.
+    const SphereLight& light = scene.light;
+    float light_distance = light.Intersect(ray);
+    if (light_distance >= 0.f && (!hit.valid || hit.distance > light_distance)) {
+        return light.emission;
+    }
+
+    // The ray missed
+    if (!hit.valid) {
+        return float3(0.f); // background color
+    }
+
+    if constexpr (MultiBounce) {
+        return trace_path<Emissive, UseCache>(ray, hit, 0, rng, scene);
+    } else {
+        return shade_direct<Emissive>(ray, hit, rng, scene);
+    }
+}
+
+// Picks the trace_ray variant for settings that are fixed for a whole render.
+// The cache only ever answers lookups after the first bounce, so direct
+// lighting never uses it.
+TraceFunction select_integrator(int max_bounces, bool emissive, bool use_cache) {
+    if (max_bounces <= 1) {
+        return emissive ? trace_ray<false, true, false> : trace_ray<false, false, false>;
+    }
+
+    if (use_cache) {
+        return emissive ? trace_ray<true, true, true> : trace_ray<true, false, true>;
+    }
+    return emissive ? trace_ray<true, true, false> : trace_ray<true, false, false>;
+}
+
+float3 trace_ray_preview(Ray ray, Rng& rng, const SceneContext& scene) {
+    ScatterEvent hit = SampleVolume(ray, rng, scene);
+    if (!hit.valid) {
+        return float3(0.f); // background color
+    }
+
+    const PreparedMaterial& material = *hit.mat;
+    float3 color = material.params.Emission;
+
+    // Convert incoming direction to tangent space
+    float3 normal = hit.gradient;
+    float3 tangent = hit.tangent;
+    float3 bitangent = cross(tangent, normal);
+    float3 wi = -ray.direction;
+    float3 wi_t = float3(dot(tangent, wi), dot(normal, wi), dot(bitangent, wi));
+
+    color += SampleLights(wi_t, hit.position, hit.gradient, material, rng, scene);
+    color += material.params.BaseColor * (PREVIEW_AMBIENT * scene.ao->ao_at(hit.position));
+
+    return color;
+}
@@ -0,0 +1,79 @@
+#include "kernels.h"
+
+// The kernel bodies in kernels.inl are compiled here at the baseline level.
+// On x86 with GCC the build also compiles kernels_sse42.cpp,
+// kernels_avx2.cpp and kernels_avx512.cpp with their own -m flags and defines
+// MIR_MULTI_ISA, and the best table the CPU supports is picked at startup.
+namespace isa_baseline {
+#define KERNELS_ISA IsaLevel::BASELINE
+#include "kernels.inl"
+#undef KERNELS_ISA
+}
+
+#ifdef MIR_MULTI_ISA
+namespace isa_sse42 { extern const Kernels table; }
+namespace isa_avx2 { extern const Kernels table; }
+namespace isa_avx512 { extern const Kernels table; }
+#endif
+
+static const Kernels* get_table(IsaLevel isa) {
+    switch (isa) {
+#ifdef MIR_MULTI_ISA
+    case IsaLevel::AVX512: return &isa_avx512::table;
+    case IsaLevel::AVX2: return &isa_avx2::table;
+    case IsaLevel::SSE42: return &isa_sse42::table;
+#endif
+    default: return &isa_baseline::table;
+    }
+}
+
+IsaLevel detect_isa() {
+#ifdef MIR_MULTI_ISA
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") &&
+        __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")) {
+        return IsaLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return IsaLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        return IsaLevel::SSE42;
+    }
+#endif
+    return IsaLevel::BASELINE;
+}
+
+const char* isa_name(IsaLevel isa) {
+    switch (isa) {
+    case IsaLevel::SSE42: return "sse4.2";
+    case IsaLevel::AVX2: return "avx2";
+    case IsaLevel::AVX512: return "avx512";
+    default: return "baseline";
+    }
+}
+
+bool parse_isa(const std::string& name, IsaLevel& isa) {
+    for (IsaLevel l : { IsaLevel::BASELINE, IsaLevel::SSE42, IsaLevel::AVX2, IsaLevel::AVX512 }) {
+        if (name == isa_name(l)) {
+            isa = l;
+            return true;
+        }
+    }
+    return false;
+}
+
+static const Kernels* active = get_table(detect_isa());
+
+IsaLevel select_kernels(IsaLevel isa) {
+    if ((int)isa > (int)detect_isa()) {
+        isa = detect_isa();
+    }
+
+    active = get_table(isa);
+    return active->isa;
+}
+
+const Kernels& kernels() {
+    return *active;
+}
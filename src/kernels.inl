@@ -0,0 +1,93 @@
+// Body of one kernel table. Not a standalone file: kernels.cpp and the
+// kernels_<isa>.cpp files include it inside a namespace with KERNELS_ISA
+// defined, and each of them is compiled for its instruction set. The batch
+// kernels use the widest vectors that instruction set has.
+#define LANES MATH_MAX_LANES
+
+#include "disney.inl"
+#include "disney_batch.inl"
+
+bool March(const Volume& volume, const PLF& plf, float3 origin, float3 direction, float& distance, uint16_t& sample) {
+    float3a o = origin;
+    float3a d = direction;
+
+    distance = 0.f;
+    while (distance < 2.f) {
+        distance += 0.001f;
+
+        // Check if out of bounds
+        float3a point = o + d * distance;
+        if (max_abs(point) > 2.f) {
+            return false;
+        }
+
+        // Check if we hit something
+        sample = volume.sample_at(point);
+        if (plf.has_density(sample)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Narkowicz 2015, "ACES Filmic Tone Mapping Curve". Every channel is mapped
+// on its own so the image is processed as a flat float array.
+void Tonemap(const float3* hdr, float3* ldr, size_t count) {
+    const float* in = (const float*)hdr;
+    float* out = (float*)ldr;
+
+    for (size_t i = 0; i < count * 3; i++) {
+        float x = in[i];
+        float a = 2.51f;
+        float b = 0.03f;
+        float c = 2.43f;
+        float d = 0.59f;
+        float e = 0.14f;
+        float mapped = clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0.f, 1.f);
+        out[i] = fast_pow(mapped, 2.2f);
+    }
+}
+
+// LANES samples at a time, the tail goes through the same vector code one
+// lane wide. The maximum is taken before truncation, which keeps the order.
+uint16_t RescaleHounsfield(const uint16_t* stored, uint32_t bits_stored, uint32_t high_bit, bool is_signed, float slope, float intercept, uint16_t* out, size_t count) {
+    // Bits above high_bit can hold overlays and the ones below the stored
+    // value are padding, shifting by these drops both
+    int left = 15 - (int)high_bit;
+    int right = 16 - (int)bits_stored;
+
+    const float offset = intercept + DICOM_HU_OFFSET + 0.5f;
+    const vfloat vslope = slope;
+    const vfloat voffset = offset;
+    vfloat high = 0.f;
+
+    size_t i = 0;
+    for (; i + LANES <= count; i += LANES) {
+        vfloat v = clamp(vfloat::load_samples(stored + i, left, right, is_signed) * vslope + voffset, 0.f, 65535.f);
+        v.store_samples(out + i);
+        high = max(high, v);
+    }
+
+    float max_value = hmax(high);
+    for (; i < count; i++) {
+        floatx<1> v = clamp(floatx<1>::load_samples(stored + i, left, right, is_signed) * slope + offset, 0.f, 65535.f);
+        v.store_samples(out + i);
+        max_value = v.v[0] > max_value ? v.v[0] : max_value;
+    }
+    return (uint16_t)max_value;
+}
+
+extern const Kernels table = {
+    KERNELS_ISA,
+    March,
+    Tonemap,
+    RescaleHounsfield,
+    material_evaluate.data(),
+    MaterialSample,
+    BatchGetPdf,
+    BatchEvaluate,
+    BatchSample
+};
+
+#undef LANES
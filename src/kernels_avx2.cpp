@@ -0,0 +1,9 @@
+#include "kernels.h"
+
+// kernels.inl for AVX2. CMakeLists.txt compiles this file with -mavx2, -mfma
+// and -mf16c, and only kernels.cpp refers to it, once detect_isa has checked
+// the CPU supports them.
+namespace isa_avx2 {
+#define KERNELS_ISA IsaLevel::AVX2
+#include "kernels.inl"
+}
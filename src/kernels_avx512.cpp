@@ -0,0 +1,9 @@
+#include "kernels.h"
+
+// kernels.inl for AVX-512. CMakeLists.txt compiles this file with the
+// AVX-512 F, DQ, BW and VL flags on top of the AVX2 ones, and only kernels.cpp
+// refers to it, once detect_isa has checked the CPU supports them.
+namespace isa_avx512 {
+#define KERNELS_ISA IsaLevel::AVX512
+#include "kernels.inl"
+}
@@ -0,0 +1,9 @@
+#include "kernels.h"
+
+// kernels.inl for SSE4.2. CMakeLists.txt compiles this file with -msse4.2
+// and -mpopcnt, and only kernels.cpp refers to it, once detect_isa has
+// checked the CPU supports them.
+namespace isa_sse42 {
+#define KERNELS_ISA IsaLevel::SSE42
+#include "kernels.inl"
+}
@@ -0,0 +1,64 @@
+#include "light.h"
+
+SphereLight::SphereLight(float3 position, float radius, float3 intensity) {
+    this->position = position;
+    this->radius = radius;
+    this->emission = intensity / (PI * radius * radius);
+}
+
+float SphereLight::GetConeCos(float3 p) const {
+    float3 d = position - p;
+    float sin2 = (radius * radius) / dot(d, d);
+    if (sin2 >= 1.f) return -1.f;
+
+    return sqrt(1.f - sin2);
+}
+
+float SphereLight::Sample(float3 p, float2 sample, float3& wo, float& distance) const {
+    float cos_max = GetConeCos(p);
+    if (cos_max < 0.f) return 0.f;
+
+    // Basis around the direction to the light center
+    float3 w = normalize(position - p);
+    float3 u = normalize(abs(w.x) > 0.1f ? cross(float3(0, 1, 0), w) : cross(float3(1, 0, 0), w));
+    float3 v = cross(w, u);
+
+    float costheta = 1.f - sample.x * (1.f - cos_max);
+    float sintheta = sqrt(fmax(0.f, 1.f - costheta * costheta));
+    float phi = 2 * PI * sample.y;
+    wo = normalize(u * (cos(phi) * sintheta) + v * (sin(phi) * sintheta) + w * costheta);
+
+    Ray ray;
+    ray.origin = p;
+    ray.direction = wo;
+    distance = Intersect(ray);
+
+    // Grazing directions can numerically miss the sphere
+    if (distance < 0.f) distance = length(position - p);
+
+    return 1.f / (2 * PI * (1.f - cos_max));
+}
+
+float SphereLight::GetPdf(float3 p, float3 wo) const {
+    float cos_max = GetConeCos(p);
+    if (cos_max < 0.f) return 0.f;
+
+    float3 w = normalize(position - p);
+    if (dot(wo, w) < cos_max) return 0.f;
+
+    return 1.f / (2 * PI * (1.f - cos_max));
+}
+
+float SphereLight::Intersect(Ray ray) const {
+    float3 oc = ray.origin - position;
+    float b = dot(oc, ray.direction);
+    float c = dot(oc, oc) - radius * radius;
+    float disc = b * b - c;
+    if (disc < 0.f) return -1.f;
+
+    float sq = sqrt(disc);
+    float t = -b - sq;
+    if (t < 0.f) t = -b + sq;
+
+    return t < 0.f ? -1.f : t;
+}
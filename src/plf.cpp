@@ -1,11 +1,15 @@
 #include "plf.h"
 
 PLF::PLF(DisneyMaterial first, DisneyMaterial second) {
+    emissive = false;
     add_material(0, first);
     add_material(65535, second);
 }
 
 void PLF::add_material(uint16_t value, DisneyMaterial node) {
+    baked.clear();
+    density.clear();
+
     if (nodes.empty()) {
         nodes.emplace(nodes.begin(), value, node);
         return;
@@ -24,7 +28,36 @@ void PLF::add_material(uint16_t value, DisneyMaterial node) {
     nodes.emplace_back(value, node);
 }
 
+void PLF::bake() {
+    baked.clear();
+    density.clear();
+    emissive = false;
+
+    // Built in place, default constructing 65536 materials first would
+    // prepare each one twice
+    std::vector<PreparedMaterial> lut;
+    std::vector<half> lut_density;
+    lut.reserve(65536);
+    lut_density.reserve(65536);
+    for (uint32_t i = 0; i < 65536; i++) {
+        const PreparedMaterial& material = lut.emplace_back(get_material_for((uint16_t)i));
+        lut_density.emplace_back(1.f - material.params.Transmission);
+
+        float3 emission = material.params.Emission;
+        if (emission.r > 0 || emission.g > 0 || emission.b > 0) {
+            emissive = true;
+        }
+    }
+
+    baked = std::move(lut);
+    density = std::move(lut_density);
+}
+
 DisneyMaterial PLF::get_material_for(uint16_t sample) {
+    if (!baked.empty()) {
+        return baked[sample].params;
+    }
+
     size_t upper_i = nodes.size() - 1;
     for (size_t i = 0; i < nodes.size() - 1; i++) {
         uint16_t value = std::get<0>(nodes[i]);
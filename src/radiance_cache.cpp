@@ -0,0 +1,70 @@
+#include "radiance_cache.h"
+
+// How many slots past the home slot are probed before giving up
+#define MAX_PROBES 16
+
+RadianceCache::RadianceCache(float cell_size, uint32_t log2_capacity, uint32_t min_samples) {
+    entries.resize((size_t)1 << log2_capacity);
+    mask = entries.size() - 1;
+    cell_size_recp = 1.f / cell_size;
+    this->min_samples = min_samples;
+
+    for (auto& e : entries) {
+        e.key = 0;
+        e.radiance = float3(0.f);
+        e.count = 0;
+    }
+}
+
+uint64_t RadianceCache::get_key(float3 position, float3 normal) {
+    // 20 bits per axis is plenty for the [-2, 2] scene bounds
+    int3 cell = int3(floor(position * cell_size_recp)) + (1 << 19);
+    uint64_t x = (uint64_t)(cell.x & 0xFFFFF);
+    uint64_t y = (uint64_t)(cell.y & 0xFFFFF);
+    uint64_t z = (uint64_t)(cell.z & 0xFFFFF);
+
+    // Dominant normal axis and its sign
+    float3 a = abs(normal);
+    uint64_t axis = (a.x > a.y && a.x > a.z) ? 0 : (a.y > a.z ? 1 : 2);
+    uint64_t side = normal[(int)axis] < 0.f ? 1 : 0;
+
+    // Top bit is always set so a key can never collide with an empty slot
+    return (1ull << 63) | ((axis * 2 + side) << 60) | (z << 40) | (y << 20) | x;
+}
+
+RadianceCache::Entry* RadianceCache::find(uint64_t key, bool insert) {
+    uint64_t h = key * 0x9E3779B97F4A7C15ull;
+    h ^= h >> 29;
+
+    for (uint64_t i = 0; i < MAX_PROBES; i++) {
+        Entry& e = entries[(h + i) & mask];
+        if (e.key == key) {
+            return &e;
+        }
+
+        if (e.key == 0) {
+            if (!insert) return nullptr;
+
+            e.key = key;
+            return &e;
+        }
+    }
+
+    return nullptr;
+}
+
+void RadianceCache::insert(float3 position, float3 normal, float3 radiance) {
+    Entry* e = find(get_key(position, normal), true);
+    if (e == nullptr) return;
+
+    e->radiance += radiance;
+    e->count++;
+}
+
+bool RadianceCache::lookup(float3 position, float3 normal, float3& radiance) {
+    Entry* e = find(get_key(position, normal), false);
+    if (e == nullptr || e->count < min_samples) return false;
+
+    radiance = e->radiance / (float)e->count;
+    return true;
+}
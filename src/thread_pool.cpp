@@ -0,0 +1,84 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t num_threads) {
+    active = 0;
+    stopping = false;
+
+    if (num_threads == 0) {
+        num_threads = std::thread::hardware_concurrency();
+    }
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+
+    for (size_t i = 0; i < num_threads; i++) {
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    task_available.notify_all();
+
+    for (auto& w : workers) w.join();
+}
+
+size_t ThreadPool::size() {
+    return workers.size();
+}
+
+void ThreadPool::worker_loop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            task_available.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+            if (tasks.empty()) return;
+
+            task = std::move(tasks.front());
+            tasks.pop();
+            active++;
+        }
+
+        task();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            active--;
+        }
+        task_done.notify_all();
+    }
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push(std::move(task));
+    }
+    task_available.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    task_done.wait(lock, [this] { return tasks.empty() && active == 0; });
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)>& body) {
+    // A few chunks per worker so uneven iterations still balance out
+    size_t num_chunks = workers.size() * 4;
+    size_t chunk_size = (count + num_chunks - 1) / num_chunks;
+    if (chunk_size == 0) chunk_size = 1;
+
+    for (size_t begin = 0; begin < count; begin += chunk_size) {
+        size_t end = begin + chunk_size < count ? begin + chunk_size : count;
+        enqueue([&body, begin, end] {
+            for (size_t i = begin; i < end; i++) body(i);
+        });
+    }
+
+    wait();
+}
@@ -0,0 +1,432 @@
+#include "volume_cache.h"
+#include "filesystem.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define MIRVOL_ALIGNMENT 4096
+
+// FNV-1a, 64 bit
+static uint64_t HashBytes(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+std::string MirvolFilename(const std::string& series) {
+    if (series.empty()) return "volume.mirvol";
+
+    char name[48];
+    uint64_t hash = HashBytes(0xcbf29ce484222325ull, series.data(), series.size());
+    snprintf(name, sizeof(name), "volume-%016llx.mirvol", (unsigned long long)hash);
+    return name;
+}
+
+uint64_t VolumeSourceSignature(const std::vector<std::string>& files, uint64_t options) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    uint32_t version = MIRVOL_VERSION;
+    hash = HashBytes(hash, &version, sizeof(version));
+    hash = HashBytes(hash, &options, sizeof(options));
+
+    // Directory listings come back in no particular order
+    std::vector<std::string> sorted = files;
+    std::sort(sorted.begin(), sorted.end());
+
+    for (const auto& file : sorted) {
+        std::error_code error;
+        std::filesystem::path path(file);
+        uint64_t file_size = (uint64_t)std::filesystem::file_size(path, error);
+        int64_t time = (int64_t)std::filesystem::last_write_time(path, error).time_since_epoch().count();
+
+        std::string name = path.filename().string();
+        hash = HashBytes(hash, name.data(), name.size());
+        hash = HashBytes(hash, &file_size, sizeof(file_size));
+        hash = HashBytes(hash, &time, sizeof(time));
+    }
+
+    return hash;
+}
+
+// Checks the header at the start of a fresh mapping and points data at the
+// voxels, unmapping it if it does not match
+static bool ValidateMapping(uint64_t signature, MappedVolume& mapped) {
+    memcpy(&mapped.header, mapped.mapping, sizeof(MirvolHeader));
+    const MirvolHeader& h = mapped.header;
+    size_t voxels = (size_t)h.width * h.height * h.depth;
+    bool valid = memcmp(h.magic, MIRVOL_MAGIC, sizeof(h.magic)) == 0 &&
+        h.version == MIRVOL_VERSION &&
+        h.signature == signature &&
+        voxels != 0 &&
+        h.data_offset >= sizeof(MirvolHeader) &&
+        h.data_offset + voxels * sizeof(uint16_t) <= mapped.mapping_size;
+
+    if (!valid) {
+        UnmapVolumeCache(mapped);
+        return false;
+    }
+
+    mapped.data = (uint16_t*)((uint8_t*)mapped.mapping + h.data_offset);
+    return true;
+}
+
+static void ResetMapping(MappedVolume& mapped) {
+    mapped.data = nullptr;
+    mapped.mapping = nullptr;
+    mapped.mapping_size = 0;
+    mapped.segment_signature = 0;
+#ifdef _WIN32
+    mapped.segment_handle = nullptr;
+#else
+    mapped.segment_lock = -1;
+#endif
+}
+
+static size_t MirvolFileSize(const Volume& volume) {
+    return MIRVOL_ALIGNMENT + (size_t)volume.width * volume.height * volume.depth * sizeof(uint16_t);
+}
+
+static MirvolHeader MakeHeader(uint64_t signature, const Volume& volume, double3 spacing, uint16_t max_value) {
+    MirvolHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MIRVOL_MAGIC, sizeof(header.magic));
+    header.version = MIRVOL_VERSION;
+    header.width = volume.width;
+    header.height = volume.height;
+    header.depth = volume.depth;
+    header.size[0] = volume.size.x;
+    header.size[1] = volume.size.y;
+    header.size[2] = volume.size.z;
+    header.spacing[0] = spacing.x;
+    header.spacing[1] = spacing.y;
+    header.spacing[2] = spacing.z;
+    header.max_value = max_value;
+    header.signature = signature;
+    header.data_offset = MIRVOL_ALIGNMENT;
+    return header;
+}
+
+bool MapVolumeCache(const std::string& path, uint64_t signature, MappedVolume& mapped) {
+    ResetMapping(mapped);
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart < (LONGLONG)sizeof(MirvolHeader)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr) return false;
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (view == nullptr) return false;
+
+    mapped.mapping = view;
+    mapped.mapping_size = (size_t)file_size.QuadPart;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(MirvolHeader)) {
+        close(fd);
+        return false;
+    }
+
+    // Shared and read only, every process mapping the file uses the same
+    // page cache pages
+    void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) return false;
+
+    mapped.mapping = view;
+    mapped.mapping_size = (size_t)info.st_size;
+#endif
+
+    return ValidateMapping(signature, mapped);
+}
+
+std::string VolumeSegmentName(uint64_t signature) {
+    char name[32];
+#ifdef _WIN32
+    snprintf(name, sizeof(name), "Local\\mir-%016llx", (unsigned long long)signature);
+#else
+    snprintf(name, sizeof(name), "/mir-%016llx", (unsigned long long)signature);
+#endif
+    return name;
+}
+
+#ifndef _WIN32
+// Every process attached to a segment holds a shared flock on the segment's
+// lock file. On detach, the one that can turn it into an exclusive lock is the
+// last and unlinks the segment. Attaching takes the shared lock before opening
+// the segment, so it waits for an unlink in progress instead of mapping a
+// segment about to go away. The lock files are empty and stay behind,
+// removing them would race with processes about to lock them.
+static int LockSegment(uint64_t signature) {
+    char name[32];
+    snprintf(name, sizeof(name), "mir-%016llx.lock", (unsigned long long)signature);
+
+    std::error_code error;
+    std::filesystem::path folder = std::filesystem::temp_directory_path(error);
+    if (error) folder = "/tmp";
+
+    int fd = open((folder / name).string().c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    if (flock(fd, LOCK_SH) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void UnlockSegment(uint64_t signature, int lock) {
+    // Converting the lock drops the shared one first, a process attaching in
+    // between keeps the segment and unlinks it when it detaches
+    if (flock(lock, LOCK_EX | LOCK_NB) == 0) {
+        shm_unlink(VolumeSegmentName(signature).c_str());
+    }
+    close(lock);
+}
+#endif
+
+bool MapVolumeSegment(uint64_t signature, MappedVolume& mapped) {
+    ResetMapping(mapped);
+
+    std::string name = VolumeSegmentName(signature);
+
+#ifdef _WIN32
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+    if (mapping == nullptr) return false;
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr) {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    MEMORY_BASIC_INFORMATION info;
+    VirtualQuery(view, &info, sizeof(info));
+    mapped.mapping = view;
+    mapped.mapping_size = info.RegionSize;
+    mapped.segment_handle = mapping;
+#else
+    int lock = LockSegment(signature);
+    if (lock < 0) return false;
+
+    // From here on a failure detaches through UnlockSegment, which also
+    // clears out a stale segment nobody else is attached to
+    mapped.segment_signature = signature;
+    mapped.segment_lock = lock;
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(MirvolHeader)) {
+        if (fd >= 0) close(fd);
+        UnmapVolumeCache(mapped);
+        return false;
+    }
+
+    void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) {
+        UnmapVolumeCache(mapped);
+        return false;
+    }
+
+    mapped.mapping = view;
+    mapped.mapping_size = (size_t)info.st_size;
+#endif
+
+    return ValidateMapping(signature, mapped);
+}
+
+bool CreateVolumeSegment(uint64_t signature, const Volume& volume, double3 spacing, uint16_t max_value, MappedVolume& mapped) {
+    ResetMapping(mapped);
+
+    std::string name = VolumeSegmentName(signature);
+    size_t size = MirvolFileSize(volume);
+    void* view = nullptr;
+
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, name.c_str());
+    if (mapping == nullptr) return false;
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+    if (view == nullptr) {
+        CloseHandle(mapping);
+        return false;
+    }
+    mapped.segment_handle = mapping;
+#else
+    int lock = LockSegment(signature);
+    if (lock < 0) return false;
+    mapped.segment_signature = signature;
+    mapped.segment_lock = lock;
+
+    // Exclusive, a concurrent creator wins and this process keeps its copy
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        close(lock);
+        ResetMapping(mapped);
+        return false;
+    }
+
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        UnmapVolumeCache(mapped);
+        return false;
+    }
+
+    view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) {
+        UnmapVolumeCache(mapped);
+        return false;
+    }
+#endif
+
+    // The header goes in last, readers treat a segment without the magic as
+    // missing and load the study themselves
+    MirvolHeader header = MakeHeader(signature, volume, spacing, max_value);
+    memcpy((uint8_t*)view + header.data_offset, volume.data, size - header.data_offset);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(view, &header, sizeof(header));
+
+    // The creator stays attached through the same view, read only from now on
+#ifdef _WIN32
+    DWORD protection;
+    VirtualProtect(view, size, PAGE_READONLY, &protection);
+#else
+    mprotect(view, size, PROT_READ);
+#endif
+    mapped.mapping = view;
+    mapped.mapping_size = size;
+    return ValidateMapping(signature, mapped);
+}
+
+void UnmapVolumeCache(MappedVolume& mapped) {
+    if (mapped.mapping != nullptr) {
+#ifdef _WIN32
+        UnmapViewOfFile(mapped.mapping);
+#else
+        munmap(mapped.mapping, mapped.mapping_size);
+#endif
+    }
+
+#ifdef _WIN32
+    // Windows drops the segment with its last handle and view
+    if (mapped.segment_handle != nullptr) {
+        CloseHandle(mapped.segment_handle);
+    }
+#else
+    if (mapped.segment_lock >= 0) {
+        UnlockSegment(mapped.segment_signature, mapped.segment_lock);
+    }
+#endif
+
+    ResetMapping(mapped);
+}
+
+// A fresh file next to path that no other writer can be using. mkstemp
+// creates it 0600, the cache is meant to be shared like the segments are.
+static FILE* CreateTempFile(const std::string& path, std::string& temp_path) {
+#ifdef _WIN32
+    static std::atomic<uint32_t> counter(0);
+    temp_path = path + "." + std::to_string(_getpid()) + "." + std::to_string(counter++) + ".tmp";
+    return fopen(temp_path.c_str(), "wbx");
+#else
+    std::vector<char> name(path.begin(), path.end());
+    const char suffix[] = ".XXXXXX";
+    name.insert(name.end(), suffix, suffix + sizeof(suffix));
+    int fd = mkstemp(name.data());
+    if (fd < 0) return nullptr;
+
+    temp_path = name.data();
+    FILE* file = fchmod(fd, 0644) == 0 ? fdopen(fd, "wb") : nullptr;
+    if (file == nullptr) {
+        close(fd);
+        unlink(temp_path.c_str());
+    }
+    return file;
+#endif
+}
+
+// Flushes the data to disk before the rename makes it visible, otherwise a
+// crash can leave the new name pointing at an empty or partial file
+static bool SyncFile(FILE* file) {
+    if (fflush(file) != 0) return false;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+bool WriteFileAtomic(const std::string& path, const std::function<bool(FILE* file)>& write) {
+    std::string temp_path;
+    FILE* file = CreateTempFile(path, temp_path);
+    if (file == nullptr) return false;
+
+    bool written = write(file) && SyncFile(file);
+    if (fclose(file) != 0) written = false;
+
+    std::error_code error;
+    if (written) {
+        std::filesystem::rename(temp_path, path, error);
+        if (!error) {
+#ifndef _WIN32
+            // The rename itself is only durable once the directory is synced
+            std::string folder = std::filesystem::path(path).parent_path().string();
+            int fd = open(folder.empty() ? "." : folder.c_str(), O_RDONLY);
+            if (fd >= 0) {
+                fsync(fd);
+                close(fd);
+            }
+#endif
+            return true;
+        }
+    }
+
+    std::filesystem::remove(temp_path, error);
+    return false;
+}
+
+bool WriteVolumeCache(const std::string& path, uint64_t signature, const Volume& volume, double3 spacing, uint16_t max_value) {
+    MirvolHeader header = MakeHeader(signature, volume, spacing, max_value);
+
+    return WriteFileAtomic(path, [&](FILE* file) {
+        std::vector<uint8_t> padding(MIRVOL_ALIGNMENT - sizeof(header), 0);
+        size_t voxels = (size_t)volume.width * volume.height * volume.depth;
+        return fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(padding.data(), padding.size(), 1, file) == 1 &&
+            fwrite(volume.data, sizeof(uint16_t), voxels, file) == voxels;
+    });
+}
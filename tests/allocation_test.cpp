@@ -0,0 +1,174 @@
+// Renders a synthetic volume through every integrator variant and fails if
+// the render loop allocates. Global operator new and delete are replaced with
+// counting versions for the whole executable, so allocations made anywhere
+// below trace_ray are seen.
+#include "integrator.h"
+#include "camera.h"
+#include "isa_levels.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+static std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size) {
+    allocations++;
+    void* p = std::malloc(size > 0 ? size : 1);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+    allocations++;
+    size_t alignment = (size_t)align;
+    size = (size + alignment - 1) / alignment * alignment;
+#ifdef _WIN32
+    void* p = _aligned_malloc(size > 0 ? size : alignment, alignment);
+#else
+    void* p = std::aligned_alloc(alignment, size > 0 ? size : alignment);
+#endif
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void operator delete(void* p, size_t, std::align_val_t align) noexcept {
+    operator delete(p, align);
+}
+
+#define VOLUME_RESOLUTION 64
+#define IMAGE_SIZE 32
+#define WARMUP_SAMPLES 1
+#define SAMPLES_PER_PIXEL 4
+
+// A ball whose density falls off towards its surface, in an empty box, so rays
+// miss, hit and get shadowed. The falloff keeps the gradients non-zero.
+static std::vector<uint16_t> SphereVolume(Volume& volume) {
+    std::vector<uint16_t> data((size_t)VOLUME_RESOLUTION * VOLUME_RESOLUTION * VOLUME_RESOLUTION);
+    for (uint32_t z = 0; z < VOLUME_RESOLUTION; z++) {
+        for (uint32_t y = 0; y < VOLUME_RESOLUTION; y++) {
+            for (uint32_t x = 0; x < VOLUME_RESOLUTION; x++) {
+                float3 p = (float3((float)x, (float)y, (float)z) + 0.5f) / (float)VOLUME_RESOLUTION - 0.5f;
+                data[((size_t)z * VOLUME_RESOLUTION + y) * VOLUME_RESOLUTION + x] = (uint16_t)(fmax(0.f, 0.4f - length(p)) * 100000.f);
+            }
+        }
+    }
+
+    volume.data = data.data();
+    volume.width = VOLUME_RESOLUTION;
+    volume.height = VOLUME_RESOLUTION;
+    volume.depth = VOLUME_RESOLUTION;
+    volume.size = float3(1.f);
+    return data;
+}
+
+// Air is empty, everything above it opaque and emissive when asked, so the
+// emission branches run too
+static PLF SceneTransferFunction(bool emissive) {
+    DisneyMaterial air;
+    air.Transmission = 1.f;
+
+    DisneyMaterial tissue;
+    tissue.Transmission = 0.f;
+    tissue.BaseColor = float3(0.6f, 0.3f, 0.3f);
+    tissue.Specular = 0.5f;
+    tissue.Roughness = 0.4f;
+    tissue.Clearcoat = 0.5f;
+    tissue.Sheen = 0.5f;
+    tissue.Emission = float3(emissive ? 0.1f : 0.f);
+
+    PLF plf(air, tissue);
+    plf.add_material(1000, tissue);
+    plf.bake();
+    return plf;
+}
+
+// Returns the number of allocations made while rendering samples_per_pixel
+// samples for every pixel
+static size_t Render(TraceFunction trace, const SceneContext& scene, Camera& camera, Rng& rng, uint32_t samples_per_pixel, float3& sum) {
+    size_t before = allocations;
+    for (uint32_t y = 0; y < IMAGE_SIZE; y++) {
+        for (uint32_t x = 0; x < IMAGE_SIZE; x++) {
+            for (uint32_t i = 0; i < samples_per_pixel; i++) {
+                Ray ray = camera.get_ray(x, y, true, rng);
+                sum += trace(ray, rng, scene);
+            }
+        }
+    }
+    return allocations - before;
+}
+
+int main() {
+    Volume volume;
+    std::vector<uint16_t> data = SphereVolume(volume);
+
+    ThreadPool pool;
+    Rng rng;
+    // Looks at the side of the ball facing the light
+    Camera camera(float3(0.3f, -0.6f, 0.3f), float3(0, 0, 0), float3(0, 0, 1), IMAGE_SIZE, IMAGE_SIZE);
+
+    struct Variant {
+        const char* name;
+        int max_bounces;
+        bool emissive;
+        bool use_cache;
+        bool preview;
+    };
+    const Variant variants[] = {
+        { "direct", 1, false, false, false },
+        { "direct emissive", 1, true, false, false },
+        { "path", 2, false, false, false },
+        { "path emissive", 2, true, false, false },
+        { "path cached", 2, false, true, false },
+        { "path emissive cached", 2, true, true, false },
+        { "preview", 1, false, false, true },
+    };
+
+    bool passed = true;
+    for_each_supported_isa([&](IsaLevel isa) {
+        for (const Variant& v : variants) {
+            // Everything the render reads is built up front, as main does
+            PLF plf = SceneTransferFunction(v.emissive);
+            RadianceCache cache(0.05f, v.use_cache ? 12 : 0, 1);
+            AOVolume ao;
+            if (v.preview) {
+                ao.build(volume, plf, 16, 0.1f, pool);
+            }
+            const SceneContext scene = { volume, plf, SceneLight(), &cache, &ao };
+            TraceFunction trace = v.preview ? trace_ray_preview : select_integrator(v.max_bounces, v.emissive, v.use_cache);
+
+            float3 sum = 0.f;
+            Render(trace, scene, camera, rng, WARMUP_SAMPLES, sum);
+            size_t count = Render(trace, scene, camera, rng, SAMPLES_PER_PIXEL, sum);
+
+            bool lit = sum.x > 0.f;
+            std::cout << isa_name(isa) << " " << v.name << ": " << count << " allocations" << (lit ? "" : ", image is black or NaN") << std::endl;
+            passed = passed && count == 0 && lit;
+        }
+    });
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+// Sweeps the approx_* functions from math.hpp against libm over the ranges
+// listed in its fast math region and checks the max errors stated there, for
+// the scalar and, where the target has SSE2, the four lane versions.
+#include "math.hpp"
+
+#include <cfloat>
+#include <cmath>
+#include <functional>
+#include <iostream>
+
+// Sweeps [lo, hi] in steps + 1 points, linearly or in equal steps of the
+// exponent
+static void Sweep(double lo, double hi, bool logarithmic, int steps, const std::function<void(float x)>& f) {
+    for (int i = 0; i <= steps; i++) {
+        double t = (double)i / steps;
+        double x = logarithmic ? lo * std::pow(hi / lo, t) : lo + (hi - lo) * t;
+        f((float)x);
+    }
+}
+
+static double Relative(double value, double reference) {
+    return std::abs(value - reference) / std::abs(reference);
+}
+
+// Absolute while the reference is below 1 in magnitude, relative above
+static double Mixed(double value, double reference) {
+    return std::abs(value - reference) / std::max(1.0, std::abs(reference));
+}
+
+struct Check {
+    const char* name;
+    double bound;
+    double max_error = 0.0;
+    float worst = 0.f;
+
+    void add(float x, double error) {
+        if (!(error <= max_error)) {
+            max_error = error;
+            worst = x;
+        }
+    }
+
+    bool report() const {
+        bool passed = max_error <= bound;
+        std::cout << name << ": max error " << max_error << " at " << worst << ", bound " << bound << (passed ? "" : " FAILED") << std::endl;
+        return passed;
+    }
+};
+
+// The four lane versions only exist with SSE2
+static bool Report(const Check& scalar, const Check& sse) {
+    bool passed = scalar.report();
+#if defined(__SSE2__) || defined(_M_X64)
+    passed = sse.report() && passed;
+#else
+    (void)sse;
+#endif
+    return passed;
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+// Runs a four lane function on x in every lane
+static float Lane(__m128 (*f)(__m128), float x) {
+    return _mm_cvtss_f32(f(_mm_set1_ps(x)));
+}
+#endif
+
+static bool TestExp2() {
+    Check scalar = { "approx_exp2", 1.1e-7 };
+    Check sse = { "approx_exp2 sse", 1.1e-7 };
+    Sweep(-126.0, 127.0, false, 1 << 20, [&](float x) {
+        double reference = std::exp2((double)x);
+        scalar.add(x, Relative(approx_exp2(x), reference));
+#if defined(__SSE2__) || defined(_M_X64)
+        sse.add(x, Relative(Lane(approx_exp2, x), reference));
+#endif
+    });
+    return Report(scalar, sse);
+}
+
+static bool TestLog2() {
+    Check scalar = { "approx_log2", 8.0e-8 };
+    Check sse = { "approx_log2 sse", 8.0e-8 };
+    Sweep(1e-30, 1e30, true, 1 << 20, [&](float x) {
+        double reference = std::log2((double)x);
+        scalar.add(x, Mixed(approx_log2(x), reference));
+#if defined(__SSE2__) || defined(_M_X64)
+        sse.add(x, Mixed(Lane(approx_log2, x), reference));
+#endif
+    });
+    return Report(scalar, sse);
+}
+
+static bool TestPow() {
+    Check scalar = { "approx_pow", 9.0e-6 };
+    Check sse = { "approx_pow sse", 9.0e-6 };
+    for (float b = 0.f; b <= 64.f; b += 0.5f) {
+        // Stays where the result is a normal float, approx_exp2 clamps below
+        float lo = b > 0.f ? std::max(1e-30f, std::exp2(-126.f / b)) : 1e-30f;
+        Sweep(lo, 1.0, true, 1 << 14, [&](float a) {
+            double reference = std::pow((double)a, (double)b);
+            if (reference < FLT_MIN) return;
+            scalar.add(a, Relative(approx_pow(a, b), reference));
+#if defined(__SSE2__) || defined(_M_X64)
+            sse.add(a, Relative(_mm_cvtss_f32(approx_pow(_mm_set1_ps(a), _mm_set1_ps(b))), reference));
+#endif
+        });
+    }
+    return Report(scalar, sse);
+}
+
+static bool TestSincos() {
+    Check scalar = { "approx_sincos", 9.3e-8 };
+    Check sse = { "approx_sincos sse", 9.3e-8 };
+    Sweep(-8192.0, 8192.0, false, 1 << 20, [&](float x) {
+        double s_reference = std::sin((double)x);
+        double c_reference = std::cos((double)x);
+
+        float s, c;
+        approx_sincos(x, s, c);
+        scalar.add(x, std::max(std::abs(s - s_reference), std::abs(c - c_reference)));
+#if defined(__SSE2__) || defined(_M_X64)
+        __m128 vs, vc;
+        approx_sincos(_mm_set1_ps(x), vs, vc);
+        s = _mm_cvtss_f32(vs);
+        c = _mm_cvtss_f32(vc);
+        sse.add(x, std::max(std::abs(s - s_reference), std::abs(c - c_reference)));
+#endif
+    });
+    return Report(scalar, sse);
+}
+
+static bool TestRsqrt() {
+#if defined(__SSE__) || defined(_M_X64)
+    Check scalar = { "approx_rsqrt", 2.7e-7 };
+#else
+    Check scalar = { "approx_rsqrt", 4.8e-6 };
+#endif
+    Check sse = { "approx_rsqrt sse", 2.7e-7 };
+    Sweep(1e-30, 1e30, true, 1 << 20, [&](float x) {
+        double reference = 1.0 / std::sqrt((double)x);
+        scalar.add(x, Relative(approx_rsqrt(x), reference));
+#if defined(__SSE2__) || defined(_M_X64)
+        sse.add(x, Relative(Lane(approx_rsqrt, x), reference));
+#endif
+    });
+    return Report(scalar, sse);
+}
+
+int main() {
+    bool passed = true;
+    passed = TestExp2() && passed;
+    passed = TestLog2() && passed;
+    passed = TestPow() && passed;
+    passed = TestSincos() && passed;
+    passed = TestRsqrt() && passed;
+    return passed ? 0 : 1;
+}
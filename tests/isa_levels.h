@@ -0,0 +1,17 @@
+#ifndef ISA_LEVELS_H
+#define ISA_LEVELS_H
+
+#include "kernels.h"
+
+// Selects each instruction set level in turn and calls f(level) with it
+// active. Levels above what the CPU supports fall back to one already
+// tested, so those are skipped.
+template <class F>
+void for_each_supported_isa(F f) {
+    for (IsaLevel isa : { IsaLevel::BASELINE, IsaLevel::SSE42, IsaLevel::AVX2, IsaLevel::AVX512 }) {
+        if (select_kernels(isa) != isa) continue;
+        f(isa);
+    }
+}
+
+#endif
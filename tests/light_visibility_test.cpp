@@ -0,0 +1,77 @@
+// Shadow rays from a convex surface facing the light must reach it. Rays are
+// marched onto an opaque ball from the light's side, and every hit within
+// 60 degrees of the light has to see it, so the surface never shadows itself.
+#include "integrator.h"
+#include "kernels.h"
+
+#include <iostream>
+#include <vector>
+
+#define VOLUME_RESOLUTION 128
+#define BALL_RADIUS 0.3f
+#define DIRECTIONS 4096
+
+int main() {
+    // A hard edged ball, the worst case for self shadowing
+    std::vector<uint16_t> data((size_t)VOLUME_RESOLUTION * VOLUME_RESOLUTION * VOLUME_RESOLUTION);
+    for (uint32_t z = 0; z < VOLUME_RESOLUTION; z++) {
+        for (uint32_t y = 0; y < VOLUME_RESOLUTION; y++) {
+            for (uint32_t x = 0; x < VOLUME_RESOLUTION; x++) {
+                float3 p = (float3((float)x, (float)y, (float)z) + 0.5f) / (float)VOLUME_RESOLUTION - 0.5f;
+                data[((size_t)z * VOLUME_RESOLUTION + y) * VOLUME_RESOLUTION + x] = length(p) < BALL_RADIUS ? 30000 : 0;
+            }
+        }
+    }
+
+    Volume volume;
+    volume.data = data.data();
+    volume.width = VOLUME_RESOLUTION;
+    volume.height = VOLUME_RESOLUTION;
+    volume.depth = VOLUME_RESOLUTION;
+    volume.size = float3(1.f);
+
+    DisneyMaterial air;
+    air.Transmission = 1.f;
+    DisneyMaterial tissue;
+    tissue.Transmission = 0.f;
+    PLF plf(air, tissue);
+    plf.bake();
+
+    RadianceCache cache(0.05f, 0, 1);
+    AOVolume ao;
+    const SceneContext scene = { volume, plf, SceneLight(), &cache, &ao };
+    const SphereLight& light = scene.light;
+
+    Rng rng;
+    int facing = 0, occluded = 0;
+    for (int i = 0; i < DIRECTIONS; i++) {
+        // Uniform directions on the sphere, hits are marched from just
+        // outside the ball towards its centre
+        float3 d;
+        do {
+            d = float3(rng.generate(), rng.generate(), rng.generate()) * 2.f - 1.f;
+        } while (length(d) > 1.f || length(d) < 0.1f);
+        d = normalize(d);
+
+        float distance;
+        uint16_t sample;
+        float3 origin = d * (BALL_RADIUS + 0.05f);
+        if (!kernels().march(volume, plf, origin, -d, distance, sample)) {
+            std::cerr << "ray towards the centre missed the ball" << std::endl;
+            return 1;
+        }
+        float3 p = origin - d * distance;
+
+        float3 to_light = light.position - p;
+        float3 wo = normalize(to_light);
+        if (dot(wo, d) < 0.5f) continue;
+
+        facing++;
+        if (!LightVisible(p, wo, length(to_light) - light.radius, rng, scene)) {
+            occluded++;
+        }
+    }
+
+    std::cout << occluded << " of " << facing << " hits facing the light are occluded" << std::endl;
+    return facing > 0 && occluded == 0 ? 0 : 1;
+}